@@ -0,0 +1,120 @@
+#include "agg.h"
+#include "level.h"
+
+#define D2_MAX ((uint32_t)LEVEL_VALID_MAX_CM * LEVEL_VALID_MAX_CM)
+
+static void agg_clear(agg_t *a) {
+    a->n = 0;
+    a->invalid = 0;
+    a->min = INT16_MAX;
+    a->max = INT16_MIN;
+    a->ref = 0;
+    a->sum = 0;
+    a->sq = 0;
+    for (uint8_t i = 0; i < 3; i++) a->state_ms[i] = 0;
+}
+
+void agg_init(agg_t *a, uint32_t now) {
+    agg_clear(a);
+    a->last_ms = now;
+    a->last_state = STATE_SAFE;
+}
+
+// Time since the previous sample counts for the state that held during it
+static void agg_time(agg_t *a, uint32_t now) {
+    if (a->last_state < 3) a->state_ms[a->last_state] += now - a->last_ms;
+    a->last_ms = now;
+}
+
+void agg_add(agg_t *a, int16_t raw_cm, uint8_t state, uint32_t now) {
+    agg_time(a, now);
+    a->last_state = state;
+
+    if (!level_valid(raw_cm)) {
+        if (a->invalid < UINT16_MAX) a->invalid++;
+        return;
+    }
+    if (!a->n) a->ref = raw_cm;
+
+    // Full once another reading might overflow sq (at the earliest after
+    // some 27000 full-range swings). Checked against the largest possible
+    // square, not this one, so no part of the range is favoured.
+    if (a->n == UINT16_MAX || a->sq > UINT32_MAX - D2_MAX) return;
+    int16_t d = (int16_t)(raw_cm - a->ref);
+
+    a->n++;
+    if (raw_cm < a->min) a->min = raw_cm;
+    if (raw_cm > a->max) a->max = raw_cm;
+    a->sum += d;
+    a->sq += (uint32_t)((int32_t)d * d);
+}
+
+uint16_t agg_samples(const agg_t *a) {
+    return (uint16_t)(a->n + a->invalid);
+}
+
+static uint16_t isqrt32(uint32_t v) {
+    uint32_t r = 0;
+    uint32_t bit = 1UL << 30;
+    while (bit > v) bit >>= 2;
+    while (bit) {
+        if (v >= r + bit) {
+            v -= r + bit;
+            r = (r >> 1) + bit;
+        } else {
+            r >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint16_t)r;
+}
+
+// q / n rounded to nearest, halves up
+static int32_t div_round(int32_t q, uint16_t n) {
+    int32_t x = q + n / 2;
+    return (x < 0) ? -((-x + n - 1) / n) : x / n;
+}
+
+// Sample variance in 0.01 cm^2. With m = sum / n rounded and r the
+// remainder, the squared deviations from the mean add up to
+// sq - m * (2 * sum - n * m) - r^2 / n. That is at most sq, so unsigned
+// arithmetic modulo 2^32 gets it exactly.
+static uint32_t var_hundredths(const agg_t *a) {
+    if (a->n < 2) return 0;
+    int32_t m = div_round(a->sum, a->n);
+    int32_t r = a->sum - m * a->n;
+    uint32_t ss = a->sq - (uint32_t)m * (uint32_t)(2 * a->sum - m * a->n) - (uint32_t)(r * r) / a->n;
+    uint16_t k = a->n - 1;
+    return (ss / k) * 100UL + ((ss % k) * 100UL + k / 2) / k;
+}
+
+static int16_t tenths(uint32_t ms) {
+    uint32_t t = ms / 100;
+    return (t > INT16_MAX) ? INT16_MAX : (int16_t)t;
+}
+
+void agg_close(agg_t *a, uint32_t now, reading_t *r) {
+    agg_time(a, now);
+
+    if (a->n) {
+        r->f[AGG_MEAN] = (int16_t)(a->ref * 10 + div_round(a->sum * 10, a->n));
+        r->f[AGG_MIN] = a->min;
+        r->f[AGG_MAX] = a->max;
+        r->f[AGG_SD] = (int16_t)isqrt32(var_hundredths(a));    // 0.1 cm
+    } else {
+        r->f[AGG_MEAN] = READING_NONE;
+        r->f[AGG_MIN] = READING_NONE;
+        r->f[AGG_MAX] = READING_NONE;
+        r->f[AGG_SD] = READING_NONE;
+    }
+
+    uint16_t total = agg_samples(a);
+    r->f[AGG_INVALID] = total ? (int16_t)(((uint32_t)a->invalid * 1000UL + total / 2) / total) : READING_NONE;
+
+    r->f[AGG_T_SAFE] = tenths(a->state_ms[STATE_SAFE]);
+    r->f[AGG_T_PREPARE] = tenths(a->state_ms[STATE_PREPARE]);
+    r->f[AGG_T_EVAC] = tenths(a->state_ms[STATE_EVAC]);
+    r->status = READING_ROUTINE;
+
+    agg_clear(a);
+}
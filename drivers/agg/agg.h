@@ -0,0 +1,51 @@
+#ifndef AGG_H
+#define AGG_H
+
+#include <stdint.h>
+#include "store.h"
+
+// Per-interval statistics of the raw readings between two uploads, kept in
+// O(1) space and O(1) time per sample. Mean and variance come from integer
+// sums of the offsets from the interval's first reading, so no soft-float
+// code is linked. agg_close() turns them into the fields of one queued
+// reading.
+
+// Field layout of reading_t.f[] (ThingSpeak field1..field8)
+#define AGG_MEAN        0   // mean of valid readings, 0.1 cm
+#define AGG_MIN         1   // cm
+#define AGG_MAX         2   // cm
+#define AGG_SD          3   // standard deviation, 0.1 cm
+#define AGG_INVALID     4   // timeouts / out of range, 0.1 %
+#define AGG_T_SAFE      5   // time in each confirmed state, 0.1 s
+#define AGG_T_PREPARE   6
+#define AGG_T_EVAC      7
+
+// Fields stored in tenths (uploaded with one decimal)
+#define AGG_TENTHS  ((1u << AGG_MEAN) | (1u << AGG_SD) | (1u << AGG_INVALID) | \
+                     (1u << AGG_T_SAFE) | (1u << AGG_T_PREPARE) | (1u << AGG_T_EVAC))
+
+typedef struct {
+    uint16_t n;             // valid readings
+    uint16_t invalid;
+    int16_t min, max;
+    int16_t ref;            // first valid reading, the offsets' origin
+    int32_t sum;            // sum of (reading - ref)
+    uint32_t sq;            // sum of (reading - ref)^2; full at UINT32_MAX
+    uint32_t state_ms[3];   // indexed by STATE_*
+    uint32_t last_ms;       // time of the previous sample
+    uint8_t last_state;
+} agg_t;
+
+void agg_init(agg_t *a, uint32_t now);
+
+// One raw reading (-1 = timeout) and the confirmed state after it
+void agg_add(agg_t *a, int16_t raw_cm, uint8_t state, uint32_t now);
+
+// Samples since the interval started
+uint16_t agg_samples(const agg_t *a);
+
+// Fill r->f[] (not r->ts) of a routine reading and start a new interval.
+// Fields without data (no valid reading) are READING_NONE.
+void agg_close(agg_t *a, uint32_t now, reading_t *r);
+
+#endif
@@ -1,5 +1,9 @@
 #include "buzzer.h"
+#include "level.h"
+#include "prof.h"
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 
 #ifndef F_CPU
 #define F_CPU 16000000UL
@@ -9,14 +13,44 @@
 #define T2_PRESC  64UL
 #define T2_BASE   (F_CPU / (2UL * T2_PRESC))
 
-static inline uint8_t freq_to_ocr(uint16_t f_hz) {
-    if (f_hz < 100) f_hz = 100;
-    uint32_t ocr = (T2_BASE / (uint32_t)f_hz);
-    if (ocr == 0) ocr = 1;
-    ocr -= 1;
-    if (ocr > 255) ocr = 255;
-    return (uint8_t)ocr;
-}
+// OCR2A for a tone, at compile time. 0 marks silence in the tables (it
+// would be a 62.5 kHz tone).
+#define OCR(f_hz)  ((uint8_t)(T2_BASE / (f_hz) - 1UL))
+
+//PATTERNS (flash): one OCR value per step
+typedef struct {
+    const uint8_t *steps;
+    uint8_t len;
+    uint8_t step_ms;
+    uint8_t bounce;     // play forward, then back: a sweep stored once
+} pattern_t;
+
+static const uint8_t beep[] PROGMEM = { OCR(1200), 0 };
+
+// Siren: 600 -> 1800 Hz in 101 steps of 10 ms, bounced = 2 s cycle
+#define SW(i)    OCR(600UL + (1800UL - 600UL) * (i) / 100UL)
+#define SW10(i)  SW(i), SW(i + 1), SW(i + 2), SW(i + 3), SW(i + 4), \
+                 SW(i + 5), SW(i + 6), SW(i + 7), SW(i + 8), SW(i + 9)
+
+static const uint8_t siren[] PROGMEM = {
+    SW10(0), SW10(10), SW10(20), SW10(30), SW10(40),
+    SW10(50), SW10(60), SW10(70), SW10(80), SW10(90), SW(100)
+};
+
+static const pattern_t patterns[BUZZER_N] PROGMEM = {
+    { beep,  0,               1,   0 },     // BUZZER_OFF: never steps
+    { beep,  sizeof(beep),    200, 0 },
+    { siren, sizeof(siren),   10,  1 },
+};
+
+static volatile uint8_t want = BUZZER_OFF;  // set by buzzer_play()
+
+// ISR state
+static uint8_t playing = BUZZER_OFF;
+static pattern_t pat;
+static uint8_t idx = 0;
+static int8_t dir = 1;
+static uint8_t left = 1;        // ms until the next step
 
 static inline void buzzer_hw_off(void) {
     // Disconnect toggle on OC2B
@@ -25,10 +59,11 @@ static inline void buzzer_hw_off(void) {
     PORTD &= ~(1 << PD3);
 }
 
-static inline void buzzer_hw_on(uint16_t f_hz) {
-    uint8_t o = freq_to_ocr(f_hz);
+static inline void buzzer_hw_on(uint8_t o) {
     OCR2A = o;   
     OCR2B = o;   
+    // A lower TOP than the count would run the counter past it to 255
+    if (TCNT2 > o) TCNT2 = 0;
     TCCR2A |= (1 << COM2B0); // Toggle OC2B on compare match
 }
 
@@ -47,44 +82,55 @@ void buzzer_init(void) {
     OCR2B = 200;
 
     buzzer_hw_off();
-}
 
-// 3 States
-#define STATE_SAFE      0
-#define STATE_PREPARE   1
-#define STATE_EVAC      2
+    // Step clock: Timer0 (1 ms CTC, timebase.c) compare B, half a tick
+    // away from the millis interrupt
+    OCR0B = OCR0A / 2;
+    TIFR0 = (1 << OCF0B);
+    TIMSK0 |= (1 << OCIE0B);
+}
 
-void buzzer_task(uint8_t state, uint32_t now_ms) {
-    static uint8_t prev_state = 255;
-    static uint32_t state_start = 0;
+void buzzer_play(uint8_t pattern) {
+    if (pattern < BUZZER_N) want = pattern;
+}
 
-    if (state != prev_state) {
-        prev_state = state;
-        state_start = now_ms;
-        buzzer_hw_off();
+void buzzer_task(uint8_t state) {
+    switch (state) {
+        case STATE_EVAC:    buzzer_play(BUZZER_SIREN); break;
+        case STATE_PREPARE: buzzer_play(BUZZER_BEEP);  break;
+        default:            buzzer_play(BUZZER_OFF);   break;
     }
+}
 
-    if (state == STATE_EVAC) {
-        // Siren sweep: 2 seconds full cycle (up then down)
-        uint32_t t = (now_ms - state_start) % 2000UL;
-        uint32_t tri = (t < 1000UL) ? t : (2000UL - t); 
+static inline void buzzer_step(void) {
+    uint8_t w = want;
+    if (w != playing) {
+        playing = w;
+        memcpy_P(&pat, &patterns[w], sizeof(pat));
+        idx = 0;
+        dir = 1;
+        left = 1;
+        if (!pat.len) buzzer_hw_off();
+    }
 
-        const uint16_t F_MIN = 600;
-        const uint16_t F_MAX = 1800;
+    if (!pat.len || --left) return;
+    left = pat.step_ms;
 
-        uint16_t f = (uint16_t)(F_MIN + ((uint32_t)(F_MAX - F_MIN) * tri) / 1000UL);
-        buzzer_hw_on(f);
-        return;
-    }
+    uint8_t o = pgm_read_byte(&pat.steps[idx]);
+    if (o) buzzer_hw_on(o);
+    else buzzer_hw_off();
 
-    if (state == STATE_PREPARE) {
-        // Beep: 200ms ON, 200ms OFF
-        uint32_t t = (now_ms - state_start) % 400UL;
-        if (t < 200UL) buzzer_hw_on(1200);
-        else buzzer_hw_off();
-        return;
+    // Next step: wrap, or turn around at either end
+    if (!pat.bounce) {
+        if (++idx == pat.len) idx = 0;
+    } else {
+        if ((dir > 0 && idx == pat.len - 1) || (dir < 0 && idx == 0)) dir = (int8_t)-dir;
+        idx = (uint8_t)(idx + dir);
     }
+}
 
-    // STATE_SAFE => OFF
-    buzzer_hw_off();
-}
\ No newline at end of file
+ISR(TIMER0_COMPB_vect) {
+    PROF_BEGIN();
+    buzzer_step();
+    PROF_ISR_END(PROF_ISR_BUZZER);
+}
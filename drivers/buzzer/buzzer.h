@@ -4,14 +4,24 @@
 #include <stdint.h>
 
 // OC2B pin: PD3 
+// Timer2 toggles the pin at the tone frequency. The tone itself comes from
+// flash tables of OCR2A values, one per pattern, stepped by the buzzer's
+// own interrupt (Timer0 compare B, 1 kHz; timebase_init must run first).
+// The audio therefore does not depend on how busy the main loop is, and
+// the main code only picks a pattern.
 void buzzer_init(void);
 
-// Nonblocking pattern driver:
-// state:
-// 0 = SAFE (off)
-// 1 = NOTICE (off)
-// 2 = PREPARE (200ms ON / 200ms OFF)
-// 3 = EVACUATE (siren sweep, 2s full cycle)
-void buzzer_task(uint8_t state, uint32_t now_ms);
+// Patterns
+#define BUZZER_OFF    0
+#define BUZZER_BEEP   1   // 1200 Hz, 200ms ON / 200ms OFF
+#define BUZZER_SIREN  2   // 600-1800 Hz sweep, 2s full cycle (up then down)
+#define BUZZER_N      3
+
+// Start a pattern from its beginning; no-op if it is already playing
+void buzzer_play(uint8_t pattern);
+
+// Pattern for a level state (level.h):
+// SAFE = off, PREPARE = beep, EVACUATE = siren
+void buzzer_task(uint8_t state);
 
 #endif
@@ -0,0 +1,133 @@
+#include "clock.h"
+#include "timebase.h"
+#include <avr/pgmspace.h>
+#include <string.h>
+
+static uint8_t g_boot = 0;
+static uint8_t synced = 0;
+static uint32_t boot_unix = 0;      // Unix time at millis() == 0
+
+void clock_init(uint8_t boot_id) {
+    g_boot = boot_id & 0x7F;
+    synced = 0;
+}
+
+void clock_set_unix(uint32_t unix_now) {
+    boot_unix = unix_now - millis() / 1000UL;
+    synced = 1;
+}
+
+uint8_t clock_synced(void) {
+    return synced;
+}
+
+uint32_t clock_unix(void) {
+    return synced ? boot_unix + millis() / 1000UL : 0;
+}
+
+uint32_t clock_stamp(void) {
+    uint32_t secs = millis() / 1000UL;
+    if (synced) return boot_unix + secs;
+    return CLOCK_REL | ((uint32_t)g_boot << 24) | (secs & CLOCK_REL_SECS);
+}
+
+uint8_t clock_resolve(uint32_t stamp, uint32_t *unix_out) {
+    if (!(stamp & CLOCK_REL)) {
+        *unix_out = stamp;
+        return 1;
+    }
+    if (!synced || ((stamp >> 24) & 0x7F) != g_boot) return 0;
+    *unix_out = boot_unix + (stamp & CLOCK_REL_SECS);
+    return 1;
+}
+
+// Days since 1970-01-01 for a proleptic Gregorian date (H. Hinnant)
+static int32_t days_from_civil(int16_t y, uint8_t m, uint8_t d) {
+    y -= (m <= 2);
+    int32_t era = (y >= 0 ? y : y - 399) / 400;
+    uint16_t yoe = (uint16_t)(y - era * 400);
+    uint16_t doy = (uint16_t)((153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1);
+    uint32_t doe = (uint32_t)yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097L + (int32_t)doe - 719468L;
+}
+
+static const char months[] PROGMEM = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+static const char *parse_uint(const char *s, uint16_t *v) {
+    while (*s == ' ') s++;
+    if (*s < '0' || *s > '9') return 0;
+    uint16_t n = 0;
+    while (*s >= '0' && *s <= '9') n = (uint16_t)(n * 10 + (*s++ - '0'));
+    *v = n;
+    return s;
+}
+
+uint8_t clock_parse_ctime(const char *s, uint32_t *unix_out) {
+    uint16_t day, hh, mm, ss, year;
+    uint8_t mon = 0;
+
+    // weekday
+    while (*s == ' ') s++;
+    if (strlen(s) < 8) return 0;
+    s += 3;
+    while (*s == ' ') s++;
+
+    for (uint8_t i = 0; i < 12; i++) {
+        if (strncmp_P(s, &months[i * 3], 3) == 0) {
+            mon = (uint8_t)(i + 1);
+            break;
+        }
+    }
+    if (!mon) return 0;
+    s += 3;
+
+    if (!(s = parse_uint(s, &day)) || *s == '\0') return 0;
+    if (!(s = parse_uint(s, &hh)) || *s++ != ':') return 0;
+    if (!(s = parse_uint(s, &mm)) || *s++ != ':') return 0;
+    if (!(s = parse_uint(s, &ss))) return 0;
+    if (!(s = parse_uint(s, &year))) return 0;
+
+    if (year < 2020 || day < 1 || day > 31 || hh > 23 || mm > 59 || ss > 60) return 0;
+
+    int32_t days = days_from_civil((int16_t)year, mon, (uint8_t)day);
+    *unix_out = (uint32_t)days * 86400UL + (uint32_t)hh * 3600UL + mm * 60U + ss;
+    return 1;
+}
+
+static char *put2(char *p, uint8_t v) {
+    *p++ = (char)('0' + v / 10);
+    *p++ = (char)('0' + v % 10);
+    return p;
+}
+
+void clock_format_iso(uint32_t unix, char *out) {
+    uint32_t days = unix / 86400UL;
+    uint32_t rem = unix % 86400UL;
+
+    // civil_from_days (H. Hinnant), days >= 0
+    uint32_t z = days + 719468UL;
+    uint32_t era = z / 146097UL;
+    uint32_t doe = z - era * 146097UL;
+    uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    uint32_t mp = (5 * doy + 2) / 153;
+    uint8_t d = (uint8_t)(doy - (153 * mp + 2) / 5 + 1);
+    uint8_t m = (uint8_t)(mp < 10 ? mp + 3 : mp - 9);
+    uint16_t y = (uint16_t)(yoe + era * 400 + (m <= 2));
+
+    char *p = out;
+    p = put2(p, (uint8_t)(y / 100));
+    p = put2(p, (uint8_t)(y % 100));
+    *p++ = '-';
+    p = put2(p, m);
+    *p++ = '-';
+    p = put2(p, d);
+    *p++ = 'T';
+    p = put2(p, (uint8_t)(rem / 3600));
+    *p++ = ':';
+    p = put2(p, (uint8_t)((rem / 60) % 60));
+    *p++ = ':';
+    p = put2(p, (uint8_t)(rem % 60));
+    *p++ = 'Z';
+    *p = '\0';
+}
@@ -0,0 +1,35 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+
+// Wall clock = millis() + offset learned from SNTP.
+// Readings are stamped with clock_stamp(): Unix seconds once synced,
+// otherwise seconds since boot tagged with the boot id, which can still be
+// turned into Unix time later in the same boot (clock_resolve).
+
+#define CLOCK_REL        0x80000000UL   // stamp is boot-relative
+#define CLOCK_REL_SECS   0x00FFFFFFUL
+
+void clock_init(uint8_t boot_id);
+
+// Current Unix time (UTC) from SNTP
+void clock_set_unix(uint32_t unix_now);
+uint8_t clock_synced(void);
+uint32_t clock_unix(void);          // 0 if not synced
+
+uint32_t clock_stamp(void);
+
+// Unix time of a stamp; 0 if it is boot-relative and cannot be placed
+// (clock not synced yet, or stamped during an earlier boot)
+uint8_t clock_resolve(uint32_t stamp, uint32_t *unix_out);
+
+// "Thu Oct 17 10:00:00 2026" (AT+CIPSNTPTIME?) -> Unix time.
+// Returns 0 on a parse error or before 2020 (ESP not synced yet).
+uint8_t clock_parse_ctime(const char *s, uint32_t *unix_out);
+
+// "2026-10-17T10:00:00Z", always CLOCK_ISO_LEN chars; out must hold 21 bytes
+#define CLOCK_ISO_LEN 20
+void clock_format_iso(uint32_t unix, char *out);
+
+#endif
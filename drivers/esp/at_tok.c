@@ -0,0 +1,173 @@
+#include "at_tok.h"
+#include <avr/pgmspace.h>
+
+// Table and strings live in flash; only the match counters are in SRAM
+typedef struct {
+    const char *s;
+    at_ev_t ev;
+} tok_t;
+
+static const char t_ok[] PROGMEM      = "OK";
+static const char t_error[] PROGMEM   = "ERROR";
+static const char t_fail[] PROGMEM    = "FAIL";
+static const char t_prompt[] PROGMEM  = ">";
+static const char t_send_ok[] PROGMEM = "SEND OK";
+static const char t_connect[] PROGMEM = "CONNECT";
+static const char t_http[] PROGMEM    = "HTTP/1.1 ";
+static const char t_ipd[] PROGMEM     = "+IPD";
+static const char t_wifi[] PROGMEM    = "WIFI CONNECTED";
+static const char t_already[] PROGMEM = "ALREADY CONNECTED";
+static const char t_closed[] PROGMEM  = "CLOSED";
+static const char t_invalid[] PROGMEM = "link is not valid";
+static const char t_domain[] PROGMEM  = "+CIPDOMAIN:";
+static const char t_sntp[] PROGMEM    = "+CIPSNTPTIME:";
+static const char t_status[] PROGMEM  = "STATUS:";
+static const char t_cipstat[] PROGMEM = "+CIPSTATUS:";
+static const char t_cwjap[] PROGMEM   = "+CWJAP:";
+static const char t_wifi_d[] PROGMEM  = "WIFI DISCONNECT";
+
+static const tok_t tokens[] PROGMEM = {
+    { t_ok,      AT_EV_OK },
+    { t_error,   AT_EV_ERROR },
+    { t_fail,    AT_EV_FAIL },
+    { t_prompt,  AT_EV_PROMPT },
+    { t_send_ok, AT_EV_SEND_OK },
+    { t_connect, AT_EV_CONNECT },
+    { t_http,    AT_EV_HTTP },
+    { t_ipd,     AT_EV_IPD },
+    { t_wifi,    AT_EV_WIFI_CONN },
+    { t_already, AT_EV_ALREADY },
+    { t_closed,  AT_EV_CLOSED },
+    { t_invalid, AT_EV_CLOSED },
+    { t_domain,  AT_EV_DOMAIN },
+    { t_sntp,    AT_EV_SNTP },
+    { t_status,  AT_EV_STATUS },
+    { t_cipstat, AT_EV_LINK },
+    { t_cwjap,   AT_EV_CWJAP },
+    { t_wifi_d,  AT_EV_WIFI_DISC },
+};
+
+#define N_TOK (sizeof(tokens) / sizeof(tokens[0]))
+
+static uint8_t pos[N_TOK];  // chars of each token matched so far
+static at_ev_t events = 0;
+
+// "<digit>," at the start of the current line names a link
+static uint8_t line_pos = 0;    // chars into the line, saturating
+static char line_d = 0;
+static uint8_t line_link = 0xFF;
+static uint8_t closed = 0;
+
+static uint8_t http_code = 0;   // "HTTP/1.1 " matched: the next char is the class
+static uint8_t link_next = 0;   // "+CIPSTATUS:" matched: the next char is a link
+static uint8_t links = 0;
+
+static char cap[AT_CAP_SZ];
+static uint8_t cap_len = 0;
+static at_ev_t cap_ev = 0;  // capture in progress for this event
+
+void at_tok_reset(void) {
+    for (uint8_t i = 0; i < N_TOK; i++) pos[i] = 0;
+    events = 0;
+    line_pos = 0;
+    line_link = 0xFF;
+    closed = 0;
+    http_code = 0;
+    link_next = 0;
+    links = 0;
+    cap_ev = 0;
+    cap_len = 0;
+    cap[0] = '\0';
+}
+
+// None of the tokens has a prefix that is also its suffix, so on a
+// mismatch the only possible restart is at the token's first char. A token
+// can still sit inside another one ("CONNECT" in "WIFI DISCONNECT"): where
+// that matters the match is checked against its column.
+void at_tok_feed(char c) {
+    if (c == '\r' || c == '\n') {
+        line_pos = 0;
+        line_link = 0xFF;
+    } else {
+        if (line_pos == 0) line_d = c;
+        else if (line_pos == 1 && c == ',' && line_d >= '0' && line_d <= '7') line_link = (uint8_t)(line_d - '0');
+        if (line_pos < 0xFF) line_pos++;
+    }
+
+    if (http_code) {
+        events |= (c == '2') ? AT_EV_HTTP : AT_EV_HTTP_ERR;
+        http_code = 0;
+    }
+    if (link_next) {
+        if (c >= '0' && c <= '7') links |= (uint8_t)(1 << (c - '0'));
+        link_next = 0;
+    }
+
+    if (cap_ev) {
+        if (c == '\r' || c == '\n') {
+            cap[cap_len] = '\0';
+            events |= cap_ev;
+            cap_ev = 0;
+        } else if (cap_len < AT_CAP_SZ - 1) {
+            cap[cap_len++] = c;
+        }
+    }
+
+    for (uint8_t i = 0; i < N_TOK; i++) {
+        const char *t = (const char *)pgm_read_ptr(&tokens[i].s);
+        uint8_t p = pos[i];
+
+        if ((char)pgm_read_byte(t + p) == c) p++;
+        else p = ((char)pgm_read_byte(t) == c) ? 1 : 0;
+
+        if (pgm_read_byte(t + p) == '\0') {
+            at_ev_t ev = (at_ev_t)pgm_read_dword(&tokens[i].ev);
+            if (ev == AT_EV_STATUS && line_pos != p) {
+                // The tail of "+CIPSTATUS:", not a status line
+            } else if (ev == AT_EV_LINK) {
+                link_next = 1;
+                events |= ev;
+            } else if (pgm_read_byte(t + p - 1) == ':') {
+                cap_ev = ev;
+                cap_len = 0;
+            } else if (ev == AT_EV_HTTP) {
+                http_code = 1;
+            } else if (ev == AT_EV_CONNECT) {
+                // Only a bare "CONNECT" line. "<link>,CONNECT": CIPSTART waits
+                // for its OK, clients need nothing; anywhere else it is part
+                // of "WIFI CONNECTED", "WIFI DISCONNECT" or "ALREADY CONNECTED"
+                if (line_pos == p) events |= ev;
+            } else if (line_link != 0xFF && ev == AT_EV_CLOSED) {
+                closed |= (uint8_t)(1 << line_link);
+            } else {
+                events |= ev;
+            }
+            p = 0;
+        }
+        pos[i] = p;
+    }
+}
+
+const char *at_tok_capture(void) {
+    return cap_ev ? "" : cap;
+}
+
+uint8_t at_tok_links(void) {
+    uint8_t m = links;
+    links = 0;
+    return m;
+}
+
+uint8_t at_tok_closed(void) {
+    uint8_t m = closed;
+    closed = 0;
+    return m;
+}
+
+at_ev_t at_tok_events(void) {
+    return events;
+}
+
+void at_tok_clear(void) {
+    events = 0;
+}
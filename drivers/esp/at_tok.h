@@ -0,0 +1,59 @@
+#ifndef AT_TOK_H
+#define AT_TOK_H
+
+#include <stdint.h>
+
+// Streaming matcher for ESP8266 AT result tokens.
+// Bytes are fed one at a time as they come out of the UART RX ring; every
+// token that completes sets its event bit. Nothing is buffered, so the cost
+// per byte is fixed and a long response can never push a token out.
+
+#define AT_EV_OK         (1u << 0)   // "OK"
+#define AT_EV_ERROR      (1u << 1)   // "ERROR"
+#define AT_EV_FAIL       (1u << 2)   // "FAIL"
+#define AT_EV_PROMPT     (1u << 3)   // ">"
+#define AT_EV_SEND_OK    (1u << 4)   // "SEND OK"
+#define AT_EV_CONNECT    (1u << 5)   // "CONNECT" starting a line
+#define AT_EV_HTTP       (1u << 6)   // "HTTP/1.1 2xx": request accepted
+#define AT_EV_IPD        (1u << 7)   // "+IPD"
+#define AT_EV_WIFI_CONN  (1u << 8)   // "WIFI CONNECTED"
+#define AT_EV_ALREADY    (1u << 9)   // "ALREADY CONNECTED"
+#define AT_EV_HTTP_ERR   (1u << 10)  // "HTTP/1.1 <not 2xx>": rejected
+#define AT_EV_CLOSED     (1u << 11)  // "CLOSED" or "link is not valid"
+#define AT_EV_DOMAIN     (1u << 12)  // "+CIPDOMAIN:<ip>" line complete
+#define AT_EV_SNTP       (1u << 13)  // "+CIPSNTPTIME:<ctime>" line complete
+#define AT_EV_STATUS     (1u << 14)  // "STATUS:<n>" line complete (line start only)
+#define AT_EV_CWJAP      (1u << 15)  // "+CWJAP:<ap info or error code>" line complete
+#define AT_EV_WIFI_DISC  (1UL << 16) // "WIFI DISCONNECT"
+#define AT_EV_LINK       (1UL << 17) // "+CIPSTATUS:<link>,...": see at_tok_links()
+
+// Tokens ending in ':' capture the rest of their line (up to AT_CAP_SZ-1
+// chars); the event fires at the line end and the text is then readable
+// through at_tok_capture() until the next capturing token starts. Sized for
+// +CWJAP: with a 32-char SSID ("ssid","bssid",channel,rssi).
+#define AT_CAP_SZ 64
+
+typedef uint32_t at_ev_t;
+
+// With AT+CIPMUX=1 the ESP reports connections per link, "<link>,CONNECT"
+// and "<link>,CLOSED" at the start of a line. Those raise no event; a close
+// sets the link's bit (0..7) instead.
+uint8_t at_tok_closed(void);    // links closed since the last call
+
+// AT+CIPSTATUS lists each open connection as "+CIPSTATUS:<link>,...";
+// links listed since the last call (bit per link)
+uint8_t at_tok_links(void);
+
+// Forget partial matches and events
+void at_tok_reset(void);
+
+void at_tok_feed(char c);
+
+// Text of the last completed capture ("" if none)
+const char *at_tok_capture(void);
+
+// Events seen since the last at_tok_clear()
+at_ev_t at_tok_events(void);
+void at_tok_clear(void);
+
+#endif
@@ -1,90 +1,279 @@
 #include "esp.h"
 #include "uart.h"
+#include "timebase.h"
+#include "at_tok.h"
+#include "tsreq.h"
+#include "store.h"
+#include "clock.h"
+#include "gpio.h"
+#include "fmt.h"
+#include "lan.h"
+#include "mqtt.h"
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 #include <string.h>
-#include <stdio.h>
+#include <stdlib.h>
 
 #ifndef F_CPU
 #define F_CPU 16000000UL
 #endif
 
-//millis using Timer0 CTC 1ms 
-static volatile uint32_t g_ms = 0;
+#define STR_(x) #x
+#define STR(x) STR_(x)
 
-ISR(TIMER0_COMPA_vect) { g_ms++; }
-
-void timebase_init(void) {
-    TCCR0A = (1 << WGM01);
-    TCCR0B = (1 << CS01) | (1 << CS00); // /64
-    OCR0A  = 249;                       // 1ms
-    TIMSK0 = (1 << OCIE0A);
-}
-
-uint32_t millis(void) {
-    uint32_t m;
-    uint8_t s = SREG;
-    cli();
-    m = g_ms;
-    SREG = s;
-    return m;
-}
+#if ESP_MQTT
+#define CLOUD_HOST MQTT_HOST
+#define CLOUD_PORT STR(MQTT_PORT)
+#else
+#define CLOUD_HOST TS_HOST
+#define CLOUD_PORT "80"
+#endif
 
-//ESP response accumulator (drained from UART RX ring buffer)
-#define RESP_SZ 512
-static char resp[RESP_SZ];
-static uint16_t resp_len = 0;
+//ESP responses: UART RX ring -> streaming token matcher (at_tok.c).
+//Data for a status client ("+IPD,<link>,<len>:" and its payload) goes to
+//lan.c instead; the cloud link's stays with the matcher, or goes to the
+//MQTT packet parser (ESP_MQTT=1).
+static uint32_t rx_bytes = 0;
+static uint8_t cloud_closed = 0;  // "4,CLOSED" since the last resp_reset()
+
+static const char ipd_hdr[] PROGMEM = "+IPD,";
+#define IPD_LINK 5          // after the header: link id, then length
+#define IPD_LEN  6
+#define IPD_DATA 7
+static uint8_t ipd_st = 0;
+static uint8_t ipd_link = 0;
+static uint16_t ipd_left = 0;
 
 static void resp_reset(void) {
-    resp_len = 0;
-    resp[0] = '\0';
+    at_tok_clear();
+    mqtt_clear();
+    cloud_closed = 0;
 }
 
-static void resp_append_from_uart(void) {
-    while (uart_available()) {
-        char c = uart_getc_nb();
-        if (resp_len + 1 < RESP_SZ) {
-            resp[resp_len++] = c;
-            resp[resp_len] = '\0';
+static void resp_byte(char c) {
+    if (ipd_st == IPD_DATA) {
+        if (--ipd_left == 0) ipd_st = 0;
+        if (ipd_link != ESP_CLOUD_LINK) {
+            lan_feed(ipd_link, c);
+            return;
+        }
+        if (ESP_MQTT) {
+            mqtt_feed((uint8_t)c);
+            return;
+        }
+    } else if (ipd_st < IPD_LINK) {
+        if (c == (char)pgm_read_byte(&ipd_hdr[ipd_st])) ipd_st++;
+        else ipd_st = (c == '+');
+    } else if (ipd_st == IPD_LINK) {
+        if (c == ',') {
+            ipd_st = IPD_LEN;
+            ipd_left = 0;
         } else {
-            // if full, reset to avoid overflow
-            resp_reset();
+            ipd_link = (uint8_t)(c - '0');
         }
+    } else if (c >= '0' && c <= '9') {
+        ipd_left = (uint16_t)(ipd_left * 10 + (c - '0'));
+    } else {
+        ipd_st = (c == ':' && ipd_left) ? IPD_DATA : 0;
     }
+    at_tok_feed(c);
 }
 
-static uint8_t resp_has(const char *needle) {
-    return (needle && strstr(resp, needle)) ? 1 : 0;
+// Returns 1 if anything came in
+static uint8_t resp_append_from_uart(void) {
+    uint8_t any = 0;
+    while (uart_available()) {
+        resp_byte(uart_getc_nb());
+        rx_bytes++;
+        any = 1;
+    }
+    return any;
 }
 
-static void esp_send_cmd(const char *cmd) {
-    uart_puts(cmd);
-    uart_puts("\r\n");
+// 1 if any of the events in the mask arrived since the last resp_reset()
+static uint8_t resp_has(at_ev_t ev) {
+    return (at_tok_events() & ev) ? 1 : 0;
+}
+
+// The upload link closed ("link is not valid" is answered to any link)
+static uint8_t cloud_lost(void) {
+    return cloud_closed || resp_has(AT_EV_CLOSED);
+}
+
+// Commands are sent all-or-nothing from pieces, so formatted commands need
+// no SRAM buffer. Returns 0 when the UART TX ring is backed up; callers keep
+// their state and retry on the next esp_task() pass.
+typedef struct {
+    const char *s;
+    uint8_t flash;      // s is a PSTR
+} piece_t;
+
+static uint8_t sent = 0;        // a command went out since the last esp_go()
+
+static uint8_t esp_send_pieces(const piece_t *pc, uint8_t n) {
+    uint16_t len = 2;
+    for (uint8_t i = 0; i < n; i++) len += pc[i].flash ? strlen_P(pc[i].s) : strlen(pc[i].s);
+    if (len > uart_tx_free()) return 0;
+
+    for (uint8_t i = 0; i < n; i++) {
+        if (pc[i].flash) uart_write_P(pc[i].s, (uint8_t)strlen_P(pc[i].s));
+        else uart_write(pc[i].s, (uint8_t)strlen(pc[i].s));
+    }
+    uart_write_P(PSTR("\r\n"), 2);
+    sent = 1;
+    return 1;
+}
+
+// cmd in flash (PSTR)
+static uint8_t esp_send_cmd(const char *cmd) {
+    piece_t pc = { cmd, 1 };
+    return esp_send_pieces(&pc, 1);
 }
 
 // nonblocking state machine 
 typedef enum {
     E_IDLE=0,
-    E_AT, E_ATE0, E_CWMODE, E_CIPMUX, E_CWJAP,
-    E_READY,
-
+    E_RESET, E_RESET_BOOT,
+    E_AT, E_BAUD_SET, E_BAUD_SWITCH, E_BAUD_CHECK, E_ATE0, E_CWMODE, E_CIPMUX,
+    E_JOIN_WAIT, E_CWJAP, E_CWJAP_Q,
+    E_SNTP_CFG, E_SNTP_TIME, E_SNTP_WAIT,
+    E_SRV_MAXCONN, E_SRV, E_SRV_TIMEOUT,
+    E_READY,        // states from here on need the AP
+    E_STATUS,
+    E_LAN_SEND, E_LAN_BODY, E_LAN_WAIT, E_LAN_CLOSE,
+
+    E_SEND_DNS,
     E_SEND_CIPSTART,
     E_SEND_CIPSEND,
+    E_SEND_BODY,
     E_SEND_WAIT_HTTP,
+    E_MQTT_WAIT,
     E_SEND_CLOSE
 } esp_state_t;
 
 static esp_state_t st = E_IDLE;
 static uint32_t deadline = 0;
+static uint8_t expect = 0;      // the state waits for an answer to a command
+
+// Send cmd (PSTR, or 0 for none), then switch to `next` with a fresh timeout.
+// If the TX ring has no room the state is left untouched so the transition
+// is retried next pass.
+// The state's timeout ran out. Compared as a signed difference, so it still
+// holds when millis() wraps (every 49.7 days).
+static uint8_t esp_due(uint32_t now) {
+    return (int32_t)(now - deadline) > 0;
+}
+
+static void esp_go(esp_state_t next, uint32_t now, uint32_t timeout_ms, const char *cmd) {
+    if (cmd && !esp_send_cmd(cmd)) return;
+    resp_reset();
+    st = next;
+    deadline = now + timeout_ms;
+    expect = sent;
+    sent = 0;
+}
 
 static const char *g_ssid = 0;
 static const char *g_pass = 0;
 
-static const char *pending_key = 0;
-static int16_t pending_val = -1;
-static uint8_t send_pending = 0;
+// Link rates, fastest first; the last one is the ESP's power-up rate.
+// 250000 is exact at 16 MHz and still leaves the RX interrupt 640 cycles
+// per byte.
+static const uint32_t bauds[] PROGMEM = { 250000UL, 115200UL, ESP_BAUD_BOOT };
+#define N_BAUDS (sizeof(bauds) / sizeof(bauds[0]))
+
+#define ESP_BAUD_CHECKS     3       // ATs at a new rate before giving up on it
+#define ESP_BAUD_SETTLE_MS  20      // ESP switches after its OK is out
+
+static uint8_t baud_cur = N_BAUDS - 1;  // rate in use (index)
+static uint8_t baud_try = 0;            // rate being probed or negotiated
+static uint8_t baud_bad = 0;            // rates that failed (bit mask)
+static uint8_t baud_checks = 0;
+
+// Uploads drain the store (store.h), alerts first, then oldest first, one
+// request per ESP_MIN_INTERVAL_MS (esp.h). Over HTTP a
+// backlog goes out TSREQ_BULK_MAX readings per request, over MQTT one per
+// PUBLISH. Readings are only popped once the server accepted them (HTTP
+// 2xx; MQTT QoS 0: once the ESP sent them), so a failed or rejected upload
+// loses nothing: it is tried again after the interval.
+
+static uint8_t configured = 0;      // esp_set_thingspeak() called
+static uint32_t last_upload = 0;
+static uint8_t upload_now = 0;      // skip the interval once (retry)
+static uint8_t batch_n = 0;         // readings in the request in flight
+static uint8_t part = 0;            // next tsreq part to queue
+static uint16_t http_rejects = 0;   // non-2xx answers (readings kept)
+
+// MQTT (ESP_MQTT=1): the session is opened as soon as the AP is joined and
+// kept up, so a reading goes out within one round trip of being queued.
+// Failed connects are retried every ESP_MIN_INTERVAL_MS.
+#define MQTT_NONE 0xFF
+static uint8_t pkt = MQTT_NONE;     // MQTT packet in flight
+static uint32_t last_connect = 0;
+static uint32_t last_tx = 0;        // last packet sent, for keepalive pings
+
+// SNTP: AT+CIPSNTPTIME? answers 1970 until the ESP has synced, so it is
+// polled a few times after joining, then again every ESP_SNTP_RETRY_MS
+// while the clock is still unset.
+#define ESP_SNTP_POLLS      5
+#define ESP_SNTP_POLL_MS    2000
+#define ESP_SNTP_RETRY_MS   600000UL
+
+static uint8_t sntp_ok = 0;         // firmware accepted AT+CIPSNTPCFG
+static uint8_t sntp_polls = 0;
+static uint32_t sntp_last = 0;
+
+// Persistent link (ESP_KEEPALIVE=1): the server is resolved once with
+// AT+CIPDOMAIN and its IP cached; the TCP connection stays open across
+// uploads (HTTP/1.1 keep-alive) and is only re-opened after the ESP reports
+// CLOSED / "link is not valid" or a send fails. ESP_KEEPALIVE=0 restores
+// connect / send / close per upload.
+#ifndef ESP_KEEPALIVE
+#define ESP_KEEPALIVE 1
+#endif
 
-// NEW: uploading flag for LCD line2
+// Failed connects to the cached IP before it is resolved again
+#define ESP_IP_MAX_FAILS 2
+
+static char server_ip[16] = "";   // dotted quad, "" = not resolved
+static uint8_t ip_fails = 0;
+static uint8_t linked = 0;        // TCP link believed open
+static uint8_t retried = 0;       // current reading already re-sent once
+
+// Link supervision. While idle, AT+CIPSTATUS checks the module and the AP
+// every ESP_HEALTH_MS. A command timeout without a single byte back is a
+// silent failure; ESP_SILENT_BUDGET of them in a row (or ESP_JOIN_BUDGET
+// failed joins) mean the module is wedged, and it is reset through its RST
+// pin. After an AP drop or a failed join the next join waits
+// ESP_BACKOFF_MIN_MS, doubling up to ESP_BACKOFF_MAX_MS, plus up to 50%
+// jitter so stations behind one AP do not retry in lockstep. A rejoin names
+// the BSSID of the last join, so the ESP skips choosing an AP.
+#define ESP_HEALTH_MS       30000UL
+#define ESP_HEALTH_RETRY_MS 3000UL
+#define ESP_SILENT_BUDGET   3
+#define ESP_JOIN_BUDGET     6
+#define ESP_JOIN_MS         20000UL
+#define ESP_BACKOFF_MIN_MS  1000UL
+#define ESP_BACKOFF_MAX_MS  15000UL
+#define ESP_RST_PULSE_MS    20
+#define ESP_BOOT_MS         1500
+
+static uint8_t silent = 0;
+static uint8_t join_fails = 0;
+static uint8_t wifi_down = 0;
+static uint32_t last_health = 0;
+static uint16_t jitter = 0xACE1;
+static char bssid[18] = "";       // "aa:bb:cc:dd:ee:ff", "" = none cached
+static uint8_t channel = 0;
+static uint16_t resets = 0;
+static uint16_t joins = 0;
+
+// Status reply in progress (lan.c builds it)
+static uint8_t lan_link = LAN_NONE;
+static uint16_t lan_replies = 0;
+
+// An upload is in flight (esp_is_uploading)
 static uint8_t g_uploading = 0;
 
 uint8_t esp_is_uploading(void) { return g_uploading; }
@@ -92,186 +281,646 @@ uint8_t esp_is_uploading(void) { return g_uploading; }
 void esp_begin(const char *ssid, const char *pass) {
     g_ssid = ssid;
     g_pass = pass;
-    resp_reset();
+    at_tok_reset();
+    lan_reset();
+    baud_cur = N_BAUDS - 1;
+    baud_try = baud_cur;
     st = E_AT;
     deadline = millis() + 1500;
-    esp_send_cmd("AT");
+    esp_send_cmd(PSTR("AT"));
+}
+
+void esp_get_stats(esp_stats_t *out) {
+    uart_rx_stats_t us;
+    uart_rx_get_stats(&us);
+    out->rx_bytes = rx_bytes;
+    out->rx_dropped = us.dropped;
+    out->rx_overruns = us.overruns;
+    out->resets = resets;
+    out->joins = joins;
+    out->channel = channel;
+    out->lan_replies = lan_replies;
+    out->http_rejects = http_rejects;
+}
+
+uint32_t esp_baud(void) {
+    return pgm_read_dword(&bauds[baud_cur]);
 }
 
 uint8_t esp_ready(void) {
     return (st == E_READY);
 }
 
-uint8_t esp_request_send_field1(const char *api_key, int16_t value_cm) {
-    if (st != E_READY) return 0;
-    if (send_pending) return 0;
+uint8_t esp_online(void) {
+    return (st >= E_READY);
+}
+
+void esp_set_status(lan_status_fn fn) {
+    lan_set_status(fn);
+}
 
-    pending_key = api_key;
-    pending_val = value_cm;
-    send_pending = 1;
-    return 1;
+void esp_set_thingspeak(const char *api_key, const char *channel_id) {
+    tsreq_init(api_key, channel_id, ESP_KEEPALIVE);
+    mqtt_init(channel_id);
+    configured = 1;
+}
+
+void esp_set_mqtt(const char *client_id, const char *user, const char *pass) {
+    mqtt_set_login(client_id, user, pass);
+}
+
+// Rates worth listening at: within tolerance, plus the power-up rate
+static uint8_t baud_usable(uint8_t i) {
+    return i == N_BAUDS - 1 || uart_baud_error(pgm_read_dword(&bauds[i])) <= UART_BAUD_TOL;
+}
+
+// Next faster rate worth asking for, or N_BAUDS
+static uint8_t baud_next(void) {
+    for (uint8_t i = 0; i < baud_cur; i++) {
+        if (!(baud_bad & (1 << i)) && baud_usable(i)) return i;
+    }
+    return N_BAUDS;
+}
+
+// AT answered at baud_cur: speed the link up if possible, else carry on
+static void esp_baud_up(uint32_t now) {
+    baud_try = baud_next();
+    if (baud_try == N_BAUDS) {
+        esp_go(E_ATE0, now, 1500, PSTR("ATE0"));
+        return;
+    }
+
+    char arg[11];
+    fmt_t f;
+    fmt_init(&f, arg, sizeof(arg));
+    fmt_u(&f, pgm_read_dword(&bauds[baud_try]));
+    piece_t pc[] = { { PSTR("AT+UART_CUR="), 1 }, { arg, 0 }, { PSTR(",8,1,0,0"), 1 } };
+    if (esp_send_pieces(pc, 3)) esp_go(E_BAUD_SET, now, 1500, 0);
+}
+
+// Look for the ESP at rate `first`, or the next usable one after it
+static void esp_probe(uint32_t now, uint8_t first) {
+    baud_try = (uint8_t)(first % N_BAUDS);
+    while (!baud_usable(baud_try)) baud_try = (uint8_t)((baud_try + 1) % N_BAUDS);
+    uart_init(pgm_read_dword(&bauds[baud_try]));
+    baud_cur = baud_try;
+    esp_go(E_AT, now, 1500, PSTR("AT"));
+}
+
+static void esp_join(uint32_t now) {
+    piece_t pc[] = {
+        { PSTR("AT+CWJAP=\""), 1 }, { g_ssid, 0 }, { PSTR("\",\""), 1 }, { g_pass, 0 }, { PSTR("\""), 1 },
+        { PSTR(",\""), 1 }, { bssid, 0 }, { PSTR("\""), 1 },
+    };
+    if (esp_send_pieces(pc, bssid[0] ? 8 : 5)) esp_go(E_CWJAP, now, ESP_JOIN_MS, 0);
+}
+
+// Pull RST low; E_RESET / E_RESET_BOOT bring the module back up. The
+// readings stay queued in the store.
+static void esp_hw_reset(uint32_t now) {
+    esp_rst_assert();
+    resets++;
+    silent = 0;
+    linked = 0;
+    wifi_down = 0;
+    g_uploading = 0;
+    lan_reset();
+    esp_go(E_RESET, now, ESP_RST_PULSE_MS, 0);
+}
+
+// Next join delay: exponential backoff plus 0..50% jitter
+static uint32_t esp_backoff(void) {
+    uint8_t n = (join_fails > 4) ? 4 : join_fails;
+    uint32_t d = ESP_BACKOFF_MIN_MS << n;
+    if (d > ESP_BACKOFF_MAX_MS) d = ESP_BACKOFF_MAX_MS;
+
+    // xorshift16, stirred with the clock
+    jitter ^= (uint16_t)millis();
+    jitter ^= (uint16_t)(jitter << 7);
+    jitter ^= (uint16_t)(jitter >> 9);
+    jitter ^= (uint16_t)(jitter << 8);
+    return d + jitter % (d / 2 + 1);
+}
+
+static void esp_join_failed(uint32_t now) {
+    bssid[0] = '\0';   // the AP may have changed: let the ESP choose again
+    if (++join_fails % ESP_JOIN_BUDGET == 0) esp_hw_reset(now);
+    else esp_go(E_JOIN_WAIT, now, esp_backoff(), 0);
+}
+
+// +CWJAP:"ssid","aa:bb:cc:dd:ee:ff",6,-60 (a bare number is an error code)
+static void esp_parse_ap(const char *s) {
+    if (*s != '"') return;
+    s = strchr(s + 1, '"');
+    if (!s || s[1] != ',' || s[2] != '"') return;
+    s += 3;
+    if (strlen(s) < 19 || s[17] != '"' || s[18] != ',') return;
+    memcpy(bssid, s, 17);
+    bssid[17] = '\0';
+    channel = (uint8_t)atoi(s + 19);
+}
+
+static void esp_sntp_query(uint32_t now) {
+    sntp_last = now;
+    esp_go(E_SNTP_TIME, now, 1500, PSTR("AT+CIPSNTPTIME?"));
+}
+
+static void esp_close(uint32_t now) {
+    linked = 0;
+    store_hold(0);      // the request is over: its readings stay queued
+    esp_go(E_SEND_CLOSE, now, 2500, PSTR("AT+CIPCLOSE=" STR(ESP_CLOUD_LINK)));
+}
+
+static void esp_connect(uint32_t now) {
+    piece_t pc[] = {
+        { PSTR("AT+CIPSTART=" STR(ESP_CLOUD_LINK) ",\"TCP\",\""), 1 },
+        { server_ip[0] ? server_ip : PSTR(CLOUD_HOST), !server_ip[0] },
+        { PSTR("\"," CLOUD_PORT), 1 },
+    };
+    if (esp_send_pieces(pc, 3)) esp_go(E_SEND_CIPSTART, now, 9000, 0);
+}
+
+// What goes out after the next CIPSEND: an HTTP request or MQTT packet `pkt`
+// Its readings stay put in the store until they are popped (store_hold).
+static uint16_t req_len(void) {
+    if (ESP_MQTT) {
+        store_hold(pkt == MQTT_PUBLISH);
+        return mqtt_len(pkt);
+    }
+    batch_n = tsreq_batch();
+    store_hold(batch_n ? batch_n : 1);
+    return tsreq_len(batch_n);
+}
+
+static uint8_t req_parts(void) {
+    return ESP_MQTT ? mqtt_parts(pkt) : tsreq_parts(batch_n);
+}
+
+static uint8_t req_part(uint8_t i, char *out) {
+    return ESP_MQTT ? mqtt_part(pkt, i, out) : tsreq_part(batch_n, i, out);
+}
+
+static void esp_cipsend(uint32_t now) {
+    char len[6];
+    fmt_t f;
+    fmt_init(&f, len, sizeof(len));
+    fmt_u(&f, req_len());
+
+    piece_t pc[] = { { PSTR("AT+CIPSEND=" STR(ESP_CLOUD_LINK) ","), 1 }, { len, 0 } };
+    if (esp_send_pieces(pc, 2)) esp_go(E_SEND_CIPSEND, now, 5000, 0);
+}
+
+// Answer a status client: one reply, then the link is closed
+static void esp_lan_send(uint32_t now, uint8_t link) {
+    char arg[8];
+    fmt_t f;
+    fmt_init(&f, arg, sizeof(arg));
+    fmt_c(&f, (char)('0' + link));
+    fmt_c(&f, ',');
+    fmt_u(&f, lan_reply_len(link));
+
+    piece_t pc[] = { { PSTR("AT+CIPSEND="), 1 }, { arg, 0 } };
+    if (!esp_send_pieces(pc, 2)) return;
+    lan_done(link);
+    lan_link = link;
+    esp_go(E_LAN_SEND, now, 2000, 0);
+}
+
+static void esp_lan_close(uint32_t now) {
+    char arg[2] = { (char)('0' + lan_link), '\0' };
+    piece_t pc[] = { { PSTR("AT+CIPCLOSE="), 1 }, { arg, 0 } };
+    if (esp_send_pieces(pc, 2)) esp_go(E_LAN_CLOSE, now, 2000, 0);
+}
+
+// After AT+CIPMUX=1: the status server, if any, then the AP
+static void esp_server(uint32_t now) {
+    if (ESP_LAN_PORT) esp_go(E_SRV_MAXCONN, now, 1500, PSTR("AT+CIPSERVERMAXCONN=2"));
+    else esp_join(now);
+}
+
+// The link died under a send. The readings are still queued; retry once
+// right away over a fresh connection instead of after the full interval.
+static void esp_link_lost(uint32_t now) {
+    if (!retried) {
+        retried = 1;
+        upload_now = 1;
+    }
+    esp_close(now);
+}
+
+static uint8_t upload_due(uint32_t now) {
+    if (!configured || !store_count()) return 0;
+    return upload_now || (now - last_upload) >= ESP_MIN_INTERVAL_MS;
+}
+
+// Next MQTT packet: open the session, publish when due, ping when quiet
+static uint8_t mqtt_next(uint32_t now) {
+    if (!configured) return MQTT_NONE;
+    if (!linked) {
+        return (upload_now || !last_connect || (now - last_connect) >= ESP_MIN_INTERVAL_MS) ? MQTT_CONNECT : MQTT_NONE;
+    }
+    if (upload_due(now)) return MQTT_PUBLISH;
+    if ((now - last_tx) >= MQTT_KEEPALIVE_S * 500UL) return MQTT_PINGREQ;
+    return MQTT_NONE;
+}
+
+static void esp_mqtt_send(uint32_t now, uint8_t next) {
+    if (next == MQTT_CONNECT) {
+        if (!server_ip[0]) esp_go(E_SEND_DNS, now, 5000, PSTR("AT+CIPDOMAIN=\"" CLOUD_HOST "\""));
+        else esp_connect(now);
+        if (st != E_READY) last_connect = now;
+        return;
+    }
+    pkt = next;
+    esp_cipsend(now);
+    if (st != E_READY && next == MQTT_PUBLISH) {
+        upload_now = 0;
+        last_upload = now;
+        g_uploading = 1;
+    }
 }
 
 void esp_task(void) {
-    resp_append_from_uart();
+    if (resp_append_from_uart()) silent = 0;
     uint32_t now = millis();
 
+    // Links the ESP closed: the cloud one or a status client's
+    uint8_t closed = at_tok_closed();
+    if (closed & (1 << ESP_CLOUD_LINK)) cloud_closed = 1;
+    lan_drop((uint8_t)(closed & ~(1 << ESP_CLOUD_LINK)));
+
+    // Server or AP dropped the connection while idle: reconnect on next send
+    if (cloud_lost()) linked = 0;
+    if (resp_has(AT_EV_WIFI_DISC) && st >= E_READY) wifi_down = 1;
+
+    // Not a byte back: count it before the state retries
+    if (expect && esp_due(now)) {
+        expect = 0;
+        if (++silent >= ESP_SILENT_BUDGET) {
+            esp_hw_reset(now);
+            return;
+        }
+    }
+
     switch (st) {
     case E_IDLE:
         break;
 
+    case E_RESET:
+        if (esp_due(now)) {
+            esp_rst_release();
+            esp_go(E_RESET_BOOT, now, ESP_BOOT_MS, 0);
+        }
+        break;
+
+    case E_RESET_BOOT:
+        // Boot noise is discarded; UART_CUR is gone, so start at boot rate
+        if (esp_due(now)) {
+            at_tok_reset();
+            esp_probe(now, N_BAUDS - 1);
+        }
+        break;
+
     case E_AT:
-        if (resp_has("OK")) {
-            resp_reset();
-            st = E_ATE0;
-            deadline = now + 1500;
-            esp_send_cmd("ATE0");
-        } else if (now > deadline) {
-            resp_reset();
-            deadline = now + 1500;
-            esp_send_cmd("AT");
+        if (resp_has(AT_EV_OK)) esp_baud_up(now);
+        else if (esp_due(now)) esp_probe(now, baud_try + 1);
+        break;
+
+    case E_BAUD_SET:
+        // The OK still comes at the old rate
+        if (resp_has(AT_EV_OK)) {
+            esp_go(E_BAUD_SWITCH, now, ESP_BAUD_SETTLE_MS, 0);
+        } else if (resp_has(AT_EV_ERROR)) {
+            // No AT+UART_CUR, or not this rate
+            baud_bad |= (uint8_t)(1 << baud_try);
+            esp_baud_up(now);
+        } else if (esp_due(now)) {
+            // The OK may have been lost after the ESP switched
+            baud_bad |= (uint8_t)(1 << baud_try);
+            esp_probe(now, baud_try);
         }
         break;
 
-    case E_ATE0:
-        if (resp_has("OK")) {
-            resp_reset();
-            st = E_CWMODE;
-            deadline = now + 1500;
-            esp_send_cmd("AT+CWMODE=1");
-        } else if (now > deadline) {
-            resp_reset();
-            deadline = now + 1500;
-            esp_send_cmd("ATE0");
+    case E_BAUD_SWITCH:
+        // AT+UART_CUR is long out once its OK came back; the check only
+        // guards anything queued since
+        if (esp_due(now) && !uart_tx_busy()) {
+            uart_init(pgm_read_dword(&bauds[baud_try]));
+            baud_checks = 0;
+            esp_go(E_BAUD_CHECK, now, 500, PSTR("AT"));
         }
         break;
 
-    case E_CWMODE:
-        if (resp_has("OK")) {
-            resp_reset();
-            st = E_CIPMUX;
-            deadline = now + 1500;
-            esp_send_cmd("AT+CIPMUX=0");
-        } else if (now > deadline) {
-            resp_reset();
-            deadline = now + 1500;
-            esp_send_cmd("AT+CWMODE=1");
+    case E_BAUD_CHECK:
+        if (resp_has(AT_EV_OK)) {
+            baud_cur = baud_try;
+            esp_go(E_ATE0, now, 1500, PSTR("ATE0"));
+        } else if (esp_due(now)) {
+            if (++baud_checks < ESP_BAUD_CHECKS) {
+                esp_go(E_BAUD_CHECK, now, 500, PSTR("AT"));
+            } else {
+                // Unusable: find the ESP again, wherever it ended up
+                baud_bad |= (uint8_t)(1 << baud_try);
+                esp_probe(now, baud_try + 1);
+            }
         }
         break;
 
+    case E_ATE0:
+        if (resp_has(AT_EV_OK)) esp_go(E_CWMODE, now, 1500, PSTR("AT+CWMODE=1"));
+        else if (esp_due(now)) esp_go(E_ATE0, now, 1500, PSTR("ATE0"));
+        break;
+
+    case E_CWMODE:
+        if (resp_has(AT_EV_OK)) esp_go(E_CIPMUX, now, 1500, PSTR("AT+CIPMUX=1"));
+        else if (esp_due(now)) esp_go(E_CWMODE, now, 1500, PSTR("AT+CWMODE=1"));
+        break;
+
     case E_CIPMUX:
-        if (resp_has("OK")) {
-            resp_reset();
-            st = E_CWJAP;
-            deadline = now + 25000;
+        if (resp_has(AT_EV_OK)) esp_server(now);
+        else if (esp_due(now)) esp_go(E_CIPMUX, now, 1500, PSTR("AT+CIPMUX=1"));
+        break;
 
-            char cmd[180];
-            snprintf(cmd, sizeof(cmd), "AT+CWJAP=\"%s\",\"%s\"", g_ssid, g_pass);
-            esp_send_cmd(cmd);
-        } else if (now > deadline) {
-            resp_reset();
-            deadline = now + 1500;
-            esp_send_cmd("AT+CIPMUX=0");
+    // The server survives AP drops, so it is set up once per ESP boot. An
+    // ERROR only costs the status page: uploads carry on without it.
+    case E_SRV_MAXCONN:
+        if (resp_has(AT_EV_OK | AT_EV_ERROR) || esp_due(now)) {
+            esp_go(E_SRV, now, 1500, PSTR("AT+CIPSERVER=1," STR(ESP_LAN_PORT)));
         }
         break;
 
+    case E_SRV:
+        // Idle clients are dropped after 10 s
+        if (resp_has(AT_EV_OK | AT_EV_ERROR) || esp_due(now)) {
+            esp_go(E_SRV_TIMEOUT, now, 1500, PSTR("AT+CIPSTO=10"));
+        }
+        break;
+
+    case E_SRV_TIMEOUT:
+        if (resp_has(AT_EV_OK | AT_EV_ERROR) || esp_due(now)) esp_join(now);
+        break;
+
+    case E_JOIN_WAIT:
+        // The ESP may rejoin on its own meanwhile
+        if (resp_has(AT_EV_WIFI_CONN)) esp_go(E_CWJAP_Q, now, 1500, PSTR("AT+CWJAP?"));
+        else if (esp_due(now)) esp_join(now);
+        break;
+
     case E_CWJAP:
-        if (resp_has("WIFI CONNECTED") || resp_has("OK") || resp_has("ALREADY CONNECTED")) {
+        if (resp_has(AT_EV_WIFI_CONN | AT_EV_OK | AT_EV_ALREADY)) {
+            esp_go(E_CWJAP_Q, now, 1500, PSTR("AT+CWJAP?"));
+        } else if (resp_has(AT_EV_FAIL) || esp_due(now)) {
+            esp_join_failed(now);
+        }
+        break;
+
+    case E_CWJAP_Q:
+        // Remember the AP for fast rejoins
+        if (resp_has(AT_EV_OK | AT_EV_ERROR) || esp_due(now)) {
+            if (resp_has(AT_EV_CWJAP)) esp_parse_ap(at_tok_capture());
+            joins++;
+            join_fails = 0;
+            wifi_down = 0;
+            last_health = now;
+            if (!sntp_ok) {
+                esp_go(E_SNTP_CFG, now, 1500, PSTR("AT+CIPSNTPCFG=1,0,\"pool.ntp.org\""));
+            } else {
+                resp_reset();
+                st = E_READY;
+            }
+        }
+        break;
+
+    case E_SNTP_CFG:
+        if (resp_has(AT_EV_OK)) {
+            sntp_ok = 1;
+            sntp_polls = 0;
+            esp_sntp_query(now);
+        } else if (resp_has(AT_EV_ERROR) || esp_due(now)) {
+            // No SNTP in this firmware: readings go out without timestamps
             resp_reset();
             st = E_READY;
-        } else if (resp_has("FAIL")) {
-            resp_reset();
-            deadline = now + 25000;
-            char cmd[180];
-            snprintf(cmd, sizeof(cmd), "AT+CWJAP=\"%s\",\"%s\"", g_ssid, g_pass);
-            esp_send_cmd(cmd);
-        } else if (now > deadline) {
+        }
+        break;
+
+    case E_SNTP_TIME:
+        if (resp_has(AT_EV_SNTP) && resp_has(AT_EV_OK | AT_EV_ERROR)) {
+            uint32_t t;
+            if (clock_parse_ctime(at_tok_capture(), &t)) {
+                clock_set_unix(t);
+                resp_reset();
+                st = E_READY;
+            } else if (++sntp_polls < ESP_SNTP_POLLS) {
+                esp_go(E_SNTP_WAIT, now, ESP_SNTP_POLL_MS, 0);
+            } else {
+                resp_reset();
+                st = E_READY;
+            }
+        } else if (resp_has(AT_EV_ERROR) || esp_due(now)) {
             resp_reset();
-            deadline = now + 25000;
-            char cmd[180];
-            snprintf(cmd, sizeof(cmd), "AT+CWJAP=\"%s\",\"%s\"", g_ssid, g_pass);
-            esp_send_cmd(cmd);
+            st = E_READY;
         }
         break;
 
+    case E_SNTP_WAIT:
+        if (esp_due(now)) esp_sntp_query(now);
+        break;
+
     case E_READY:
         g_uploading = 0;
-        if (send_pending) {
-            send_pending = 0;
-            g_uploading = 1;
+        store_hold(0);      // nothing in flight: a new alert may take the head
+        store_promote();
+        if (wifi_down) {
+            wifi_down = 0;
+            linked = 0;
+            esp_go(E_JOIN_WAIT, now, esp_backoff(), 0);
+        } else if (!(store_alert_pending() && upload_due(now)) && (lan_link = lan_next()) != LAN_NONE) {
+            // A few hundred bytes: ahead of routine uploads, which can wait
+            esp_lan_send(now, lan_link);
+        } else if (ESP_MQTT && mqtt_next(now) != MQTT_NONE) {
+            esp_mqtt_send(now, mqtt_next(now));
+        } else if (!ESP_MQTT && upload_due(now)) {
+            if (ESP_KEEPALIVE && linked) esp_cipsend(now);
+            else if (ESP_KEEPALIVE && !server_ip[0]) esp_go(E_SEND_DNS, now, 5000, PSTR("AT+CIPDOMAIN=\"" CLOUD_HOST "\""));
+            else esp_connect(now);
+
+            if (st != E_READY) {
+                upload_now = 0;
+                last_upload = now;
+                g_uploading = 1;
+            }
+        } else if (now - last_health >= ESP_HEALTH_MS) {
+            last_health = now;
+            (void)at_tok_links();
+            esp_go(E_STATUS, now, 1500, PSTR("AT+CIPSTATUS"));
+        } else if (sntp_ok && !clock_synced() && (now - sntp_last) >= ESP_SNTP_RETRY_MS) {
+            sntp_polls = ESP_SNTP_POLLS - 1;    // a single poll
+            esp_sntp_query(now);
+        }
+        break;
 
+    case E_STATUS:
+        // 2 = got IP, 3 = a connection open, 4 = all closed; else no AP.
+        // With status clients on the LAN, 3 does not mean the cloud link:
+        // that one is up if a "+CIPSTATUS:4," line lists it.
+        if (resp_has(AT_EV_STATUS) && resp_has(AT_EV_OK | AT_EV_ERROR)) {
+            char c = at_tok_capture()[0];
+            if (!(at_tok_links() & (1 << ESP_CLOUD_LINK))) linked = 0;
+            if (c < '2' || c > '4') wifi_down = 1;
             resp_reset();
-            st = E_SEND_CIPSTART;
-            deadline = now + 9000;
-            esp_send_cmd("AT+CIPSTART=\"TCP\",\"api.thingspeak.com\",80");
+            st = E_READY;
+        } else if (resp_has(AT_EV_ERROR) || esp_due(now)) {
+            // Look again soon: a wedged module uses up its budget quickly
+            last_health = now - ESP_HEALTH_MS + ESP_HEALTH_RETRY_MS;
+            resp_reset();
+            st = E_READY;
         }
         break;
 
-    case E_SEND_CIPSTART:
-        if (resp_has("CONNECT") || resp_has("OK") || resp_has("ALREADY CONNECTED")) {
-            resp_reset();
-            st = E_SEND_CIPSEND;
-            deadline = now + 5000;
+    case E_LAN_SEND:
+        if (resp_has(AT_EV_PROMPT)) {
+            part = 0;
+            esp_go(E_LAN_BODY, now, 2000, 0);
+        } else if (resp_has(AT_EV_ERROR) || esp_due(now)) {
+            esp_lan_close(now);     // client gone
+        }
+        break;
 
-            char req[260];
-            snprintf(req, sizeof(req),
-                     "GET /update?api_key=%s&field1=%d HTTP/1.1\r\n"
-                     "Host: api.thingspeak.com\r\n"
-                     "Connection: close\r\n\r\n",
-                     pending_key, (int)pending_val);
+    case E_LAN_BODY: {
+        char buf[LAN_BODY_SZ];
+        while (part < LAN_PARTS) {
+            uint8_t len = lan_reply_part(part, buf);
+            if (len > uart_tx_free()) break;
+            uart_write(buf, len);
+            sent = 1;
+            part++;
+        }
+        if (part >= LAN_PARTS) esp_go(E_LAN_WAIT, now, 2000, 0);
+        else if (esp_due(now)) esp_lan_close(now);
+        break;
+    }
 
-            char cmd[40];
-            snprintf(cmd, sizeof(cmd), "AT+CIPSEND=%u", (unsigned)strlen(req));
-            esp_send_cmd(cmd);
+    case E_LAN_WAIT:
+        if (resp_has(AT_EV_SEND_OK)) {
+            lan_replies++;
+            esp_lan_close(now);
+        } else if (resp_has(AT_EV_ERROR) || esp_due(now)) {
+            esp_lan_close(now);
+        }
+        break;
 
-        } else if (resp_has("ERROR") || now > deadline) {
+    case E_LAN_CLOSE:
+        if (resp_has(AT_EV_OK | AT_EV_ERROR) || esp_due(now)) {
             resp_reset();
-            st = E_SEND_CLOSE;
-            deadline = now + 2500;
-            esp_send_cmd("AT+CIPCLOSE");
+            st = E_READY;
         }
         break;
 
-    case E_SEND_CIPSEND:
-        if (resp_has(">")) {
-            resp_reset();
-            st = E_SEND_WAIT_HTTP;
-            deadline = now + 12000;
+    case E_SEND_DNS:
+        if (resp_has(AT_EV_DOMAIN)) {
+            strncpy(server_ip, at_tok_capture(), sizeof(server_ip) - 1);
+            server_ip[sizeof(server_ip) - 1] = '\0';
+            ip_fails = 0;
+            esp_connect(now);
+        } else if (resp_has(AT_EV_ERROR) || esp_due(now)) {
+            esp_connect(now); // no DNS answer: let CIPSTART resolve by name
+        }
+        break;
 
-            char req[260];
-            snprintf(req, sizeof(req),
-                     "GET /update?api_key=%s&field1=%d HTTP/1.1\r\n"
-                     "Host: api.thingspeak.com\r\n"
-                     "Connection: close\r\n\r\n",
-                     pending_key, (int)pending_val);
+    case E_SEND_CIPSTART:
+        if (resp_has(AT_EV_CONNECT | AT_EV_OK | AT_EV_ALREADY)) {
+            linked = 1;
+            ip_fails = 0;
+            if (ESP_MQTT) {
+                mqtt_reset();
+                pkt = MQTT_CONNECT;
+            }
+            esp_cipsend(now);
+        } else if (resp_has(AT_EV_ERROR) || esp_due(now)) {
+            // Server may have moved: resolve again after repeated failures
+            if (server_ip[0] && ++ip_fails >= ESP_IP_MAX_FAILS) server_ip[0] = '\0';
+            esp_close(now);
+        }
+        break;
 
-            uart_puts(req);
+    case E_SEND_CIPSEND:
+        if (resp_has(AT_EV_PROMPT)) {
+            part = 0;
+            esp_go(E_SEND_BODY, now, 5000, 0);
+        } else if (cloud_lost() || resp_has(AT_EV_ERROR) || esp_due(now)) {
+            esp_link_lost(now);
+        }
+        break;
 
-        } else if (now > deadline) {
-            resp_reset();
-            st = E_SEND_CLOSE;
-            deadline = now + 2500;
-            esp_send_cmd("AT+CIPCLOSE");
+    case E_SEND_BODY: {
+        // Parts go into the TX ring as it has room and drain from the UDRE
+        // interrupt, so the main loop never waits on the wire.
+        char buf[TSREQ_PART_SZ];
+        while (part < req_parts()) {
+            uint8_t len = req_part(part, buf);
+            if (len > uart_tx_free()) break;
+            uart_write(buf, len);
+            sent = 1;
+            part++;
+        }
+        if (part >= req_parts()) {
+            last_tx = now;
+            esp_go(ESP_MQTT ? E_MQTT_WAIT : E_SEND_WAIT_HTTP, now, 12000, 0);
         }
+        else if (cloud_lost() || resp_has(AT_EV_ERROR) || esp_due(now)) esp_link_lost(now);
         break;
+    }
 
     case E_SEND_WAIT_HTTP:
-        // accept any HTTP header as "uploaded"
-        if (resp_has("200 OK") || resp_has("HTTP/1.1") || resp_has("SEND OK")) {
-            resp_reset();
-            st = E_SEND_CLOSE;
-            deadline = now + 2500;
-            esp_send_cmd("AT+CIPCLOSE");
-        } else if (resp_has("ERROR") || now > deadline) {
+        // Only a 2xx means the server has the readings. A rejection (429
+        // rate limit, 5xx) keeps them for the next interval.
+        if (resp_has(AT_EV_HTTP)) {
+            store_pop(batch_n ? batch_n : 1);
+            retried = 0;
+            if (ESP_KEEPALIVE && linked && !cloud_lost()) {
+                resp_reset();
+                st = E_READY;
+                g_uploading = 0;
+            } else {
+                esp_close(now);
+            }
+        } else if (resp_has(AT_EV_HTTP_ERR)) {
+            http_rejects++;
+            retried = 0;
+            esp_close(now);
+        } else if (cloud_lost()) {
+            esp_link_lost(now);
+        } else if (resp_has(AT_EV_ERROR) || esp_due(now)) {
+            retried = 0;
+            esp_close(now);
+        }
+        break;
+
+    case E_MQTT_WAIT: {
+        // QoS 0 needs no answer: the reading is out once the ESP sent it
+        uint8_t ev = mqtt_events();
+        uint8_t done = (pkt == MQTT_CONNECT) ? (ev & MQTT_EV_CONNACK) :
+                       (pkt == MQTT_PINGREQ) ? (ev & MQTT_EV_PINGRESP) :
+                       MQTT_QOS ? (ev & MQTT_EV_PUBACK) : resp_has(AT_EV_SEND_OK);
+        if (done) {
+            if (pkt == MQTT_PUBLISH) {
+                store_pop(1);
+                retried = 0;
+            }
             resp_reset();
-            st = E_SEND_CLOSE;
-            deadline = now + 2500;
-            esp_send_cmd("AT+CIPCLOSE");
+            st = E_READY;
+            g_uploading = 0;
+        } else if (cloud_lost()) {
+            esp_link_lost(now);
+        } else if ((ev & MQTT_EV_REFUSED) || resp_has(AT_EV_ERROR) || esp_due(now)) {
+            retried = 0;
+            esp_close(now);
         }
         break;
+    }
 
     case E_SEND_CLOSE:
-        if (resp_has("OK") || now > deadline) {
+        if (resp_has(AT_EV_OK | AT_EV_ERROR) || esp_due(now)) {
             resp_reset();
             st = E_READY;
             g_uploading = 0;
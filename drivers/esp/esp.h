@@ -2,9 +2,41 @@
 #define ESP_H
 
 #include <stdint.h>
+#include "lan.h"
 
-void timebase_init(void);
-uint32_t millis(void);
+// UART rate the ESP powers up at (its AT+UART_DEF setting); main.c opens
+// the UART with it. After the first AT, esp_task() moves the link to the
+// fastest rate in esp.c's list that uart_init() can hit within its error
+// limit and that answers AT, using AT+UART_CUR (not saved in the ESP, so an
+// ESP reset falls back to this rate). A rate that fails is not tried again.
+// Since the AVR can restart without the ESP, the first AT probes every
+// listed rate in turn until one answers.
+#ifndef ESP_BAUD_BOOT
+#define ESP_BAUD_BOOT 9600UL
+#endif
+
+// Status server on the local network: GET /status on this port returns the
+// current reading as JSON (lan.h), so the station can be watched without
+// the cloud. 0 = no server. The link runs with AT+CIPMUX=1; uploads use
+// link ESP_CLOUD_LINK and at most two clients are accepted, on links 0-1.
+#ifndef ESP_LAN_PORT
+#define ESP_LAN_PORT 80
+#endif
+#define ESP_CLOUD_LINK 4
+
+// Upload protocol. 0: ThingSpeak's HTTP API, readings in bulk (tsreq.h).
+// 1: MQTT 3.1.1 (mqtt.h), one PUBLISH per reading over a session that stays
+// connected; MQTT_HOST / MQTT_PORT / MQTT_QOS pick the broker.
+#ifndef ESP_MQTT
+#define ESP_MQTT 0
+#endif
+
+// Requests (HTTP) or PUBLISHes (MQTT) at least this far apart: ThingSpeak's
+// rate limit for free channels, over HTTP and MQTT alike. A broker of your
+// own can take 0.
+#ifndef ESP_MIN_INTERVAL_MS
+#define ESP_MIN_INTERVAL_MS 15000UL
+#endif
 
 // Call frequently (main loop)
 void esp_task(void);
@@ -15,10 +47,38 @@ void esp_begin(const char *ssid, const char *pass);
 // True when WiFi init finished and ESP is ready to send
 uint8_t esp_ready(void);
 
-// Request sending a value (nonblocking). returns 1 if accepted.
-uint8_t esp_request_send_field1(const char *api_key, int16_t value_cm);
+// True while joined to the AP, busy or not (status indicator)
+uint8_t esp_online(void);
 
-// NEW: 1 when ESP is currently doing CIPSTART/CIPSEND/HTTP/CIPCLOSE sequence
+// Upload target. Once set, esp_task() uploads whatever is queued in the
+// store (store.h) whenever WiFi is up, in bulk after an outage.
+void esp_set_thingspeak(const char *api_key, const char *channel_id);
+
+// MQTT login (ESP_MQTT=1); the topic comes from esp_set_thingspeak()'s
+// channel. ThingSpeak issues all three per MQTT device.
+void esp_set_mqtt(const char *client_id, const char *user, const char *pass);
+
+// Builds the JSON body of a status reply (lan.h)
+void esp_set_status(lan_status_fn fn);
+
+// 1 from the start of an upload (connect if needed, then the HTTP request or
+// MQTT PUBLISH) until the server answered or it failed; shown on the LCD
 uint8_t esp_is_uploading(void);
 
+// Rate the link runs at now
+uint32_t esp_baud(void);
+
+typedef struct {
+    uint32_t rx_bytes;      // bytes fed to the response matcher
+    uint16_t rx_dropped;    // lost to a full UART RX ring
+    uint16_t rx_overruns;   // lost in the USART before the RX ISR ran
+    uint16_t resets;        // hardware resets of a wedged module (RST pin)
+    uint16_t joins;         // successful AP joins, reconnects included
+    uint8_t channel;        // WiFi channel of the last join, 0 = unknown
+    uint16_t lan_replies;   // status replies sent on the local network
+    uint16_t http_rejects;  // uploads the server answered with a non-2xx status
+} esp_stats_t;
+
+void esp_get_stats(esp_stats_t *out);
+
 #endif
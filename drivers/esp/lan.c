@@ -0,0 +1,109 @@
+#include "lan.h"
+#include <avr/pgmspace.h>
+#include <string.h>
+
+// Per link: in the request line (chars of "GET /status" matched), past its
+// path, request complete, or answered and waiting for the close
+enum { R_LINE = 0, R_ROUTED, R_PENDING, R_DONE };
+enum { ROUTE_STATUS = 0, ROUTE_404 };
+
+static const char req_status[] PROGMEM = "GET /status";
+#define REQ_ROOT_LEN 5      // "GET /"
+#define REQ_STATUS_LEN 11
+
+static uint8_t req_st[LAN_LINKS];
+static uint8_t req_pos[LAN_LINKS];
+static uint8_t req_route[LAN_LINKS];
+
+static lan_status_fn g_status = 0;
+
+// The reply being sent: JSON body, built once per request
+static char body[LAN_BODY_SZ];
+static uint8_t body_len = 0;
+static uint8_t reply_route = ROUTE_404;
+
+void lan_set_status(lan_status_fn fn) {
+    g_status = fn;
+}
+
+void lan_reset(void) {
+    lan_drop(0xFF);
+}
+
+void lan_drop(uint8_t links) {
+    for (uint8_t i = 0; i < LAN_LINKS; i++) {
+        if (links & (1 << i)) {
+            req_st[i] = R_LINE;
+            req_pos[i] = 0;
+        }
+    }
+}
+
+void lan_feed(uint8_t link, char c) {
+    if (link >= LAN_LINKS) return;
+
+    switch (req_st[link]) {
+    case R_LINE: {
+        uint8_t p = req_pos[link];
+        if (p < REQ_STATUS_LEN && c == (char)pgm_read_byte(&req_status[p])) {
+            req_pos[link] = (uint8_t)(p + 1);
+        } else if (c == ' ' || c == '?' || c == '\r' || c == '\n') {
+            // End of the path
+            req_route[link] = (p == REQ_ROOT_LEN || p == REQ_STATUS_LEN) ? ROUTE_STATUS : ROUTE_404;
+            req_st[link] = (c == '\n') ? R_PENDING : R_ROUTED;
+        } else {
+            req_pos[link] = 0xFF;   // matches nothing: 404
+        }
+        break;
+    }
+    case R_ROUTED:
+        if (c == '\n') req_st[link] = R_PENDING;
+        break;
+    default:
+        break;  // headers, or more after the request
+    }
+}
+
+uint8_t lan_next(void) {
+    for (uint8_t i = 0; i < LAN_LINKS; i++) {
+        if (req_st[i] == R_PENDING) return i;
+    }
+    return LAN_NONE;
+}
+
+static uint8_t head(char *out, uint8_t size) {
+    fmt_t f;
+    fmt_init(&f, out, size);
+    if (reply_route == ROUTE_STATUS) {
+        fmt_P(&f, PSTR("HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"));
+    } else {
+        fmt_P(&f, PSTR("HTTP/1.1 404 Not Found\r\n"));
+    }
+    fmt_P(&f, PSTR("Connection: close\r\nContent-Length: "));
+    fmt_u(&f, body_len);
+    fmt_P(&f, PSTR("\r\n\r\n"));
+    return fmt_len(&f);
+}
+
+uint16_t lan_reply_len(uint8_t link) {
+    fmt_t f;
+    char buf[LAN_BODY_SZ];
+
+    reply_route = (link < LAN_LINKS) ? req_route[link] : ROUTE_404;
+    fmt_init(&f, body, sizeof(body));
+    if (reply_route == ROUTE_STATUS && g_status) g_status(&f);
+    else fmt_P(&f, PSTR("not found\n"));
+    body_len = fmt_len(&f);
+
+    return (uint16_t)(head(buf, sizeof(buf)) + body_len);
+}
+
+uint8_t lan_reply_part(uint8_t i, char *out) {
+    if (i == 0) return head(out, LAN_BODY_SZ);
+    memcpy(out, body, body_len);
+    return body_len;
+}
+
+void lan_done(uint8_t link) {
+    if (link < LAN_LINKS) req_st[link] = R_DONE;
+}
@@ -0,0 +1,52 @@
+#ifndef LAN_H
+#define LAN_H
+
+#include <stdint.h>
+#include "fmt.h"
+
+// Status server for the local network. The ESP listens on ESP_LAN_PORT
+// (esp.h) and hands each request over as +IPD payload for its link; esp.c
+// routes those bytes here, and answers in the gaps of the upload state
+// machine. Requests are parsed as they arrive, one byte at a time: only the
+// request line matters, the headers are skipped. One reply per connection,
+// then the link is closed.
+//
+//   GET / or GET /status  -> 200, JSON from lan_set_status()'s callback
+//   anything else         -> 404
+
+// Link ids the ESP gives incoming connections (esp.c keeps it at 2 open)
+#define LAN_LINKS 4
+#define LAN_NONE  0xFF
+
+// Largest JSON body, including the terminating NUL
+#define LAN_BODY_SZ 96
+
+// Builds the status JSON into f, straight from RAM
+typedef void (*lan_status_fn)(fmt_t *f);
+
+void lan_set_status(lan_status_fn fn);
+
+// All links gone (ESP reset)
+void lan_reset(void);
+
+// Payload byte of a request on `link`
+void lan_feed(uint8_t link, char c);
+
+// Links closed (bit mask): the ids are free for the next client
+void lan_drop(uint8_t links);
+
+// Link with a complete request waiting for its reply, or LAN_NONE
+uint8_t lan_next(void);
+
+// Reply to `link`: builds it and returns its total length (the
+// AT+CIPSEND argument). The reply then goes out in LAN_PARTS parts.
+uint16_t lan_reply_len(uint8_t link);
+
+#define LAN_PARTS 2
+// Part i of the reply; out holds LAN_BODY_SZ bytes. Returns its length.
+uint8_t lan_reply_part(uint8_t i, char *out);
+
+// Reply sent (or given up): the link waits for nothing more
+void lan_done(uint8_t link);
+
+#endif
@@ -0,0 +1,263 @@
+#include "mqtt.h"
+#include "tsreq.h"
+#include "store.h"
+#include "clock.h"
+#include "fmt.h"
+#include "level.h"
+#include <avr/pgmspace.h>
+#include <string.h>
+
+static const char *g_id = "";
+static const char *g_user = "";
+static const char *g_pass = "";
+static const char *g_channel = "";
+
+#define TOPIC_1 "channels/"
+#define TOPIC_2 "/publish"
+#define LIT(s)  (sizeof(s) - 1)
+
+// Control packet types (high nibble of the first byte)
+#define T_CONNECT  1
+#define T_CONNACK  2
+#define T_PUBLISH  3
+#define T_PUBACK   4
+#define T_PINGREQ  12
+#define T_PINGRESP 13
+
+#define HALF_FIELDS (READING_FIELDS / 2)
+
+// Set by mqtt_len() for the parts that follow
+static uint16_t rem_len = 0;        // MQTT "remaining length"
+static uint16_t pub_id = 0;         // packet id of the last QoS 1 PUBLISH
+static reading_t pub;               // the reading being published
+static uint8_t pub_dup = 0;         // it went out before without a PUBACK
+
+// The last QoS 1 PUBLISH still waits for its PUBACK. Kept across
+// mqtt_reset(): the session outlives the connection.
+static uint8_t open_on = 0;
+static uint32_t open_ts = 0;
+static uint8_t open_status = 0;
+static uint8_t pub_sep = 0;         // the second half needs a leading '&'
+
+void mqtt_init(const char *channel_id) {
+    g_channel = channel_id;
+}
+
+void mqtt_set_login(const char *client_id, const char *user, const char *pass) {
+    g_id = client_id;
+    g_user = user;
+    g_pass = pass;
+}
+
+//RECEIVE: the broker's packets, one byte at a time. Only the first two
+//bytes after the fixed header matter (CONNACK code, PUBACK id).
+enum { RX_TYPE = 0, RX_LEN, RX_BODY };
+static uint8_t rx_st = RX_TYPE;
+static uint8_t rx_type = 0;
+static uint16_t rx_left = 0;
+static uint8_t rx_shift = 0;
+static uint8_t rx_body[2];
+static uint8_t rx_n = 0;
+static uint8_t events = 0;
+
+void mqtt_reset(void) {
+    rx_st = RX_TYPE;
+    events = 0;
+}
+
+uint8_t mqtt_events(void) {
+    return events;
+}
+
+void mqtt_clear(void) {
+    events = 0;
+}
+
+static void rx_done(void) {
+    switch (rx_type) {
+    case T_CONNACK:
+        events |= (rx_n == 2 && rx_body[1] == 0) ? MQTT_EV_CONNACK : MQTT_EV_REFUSED;
+        break;
+    case T_PUBACK:
+        if (rx_n == 2 && ((uint16_t)rx_body[0] << 8 | rx_body[1]) == pub_id) {
+            events |= MQTT_EV_PUBACK;
+            open_on = 0;
+        }
+        break;
+    case T_PINGRESP:
+        events |= MQTT_EV_PINGRESP;
+        break;
+    default:
+        break;
+    }
+}
+
+void mqtt_feed(uint8_t c) {
+    switch (rx_st) {
+    case RX_TYPE:
+        rx_type = (uint8_t)(c >> 4);
+        rx_left = 0;
+        rx_shift = 0;
+        rx_n = 0;
+        rx_st = RX_LEN;
+        break;
+
+    case RX_LEN:
+        // Up to 4 bytes, 7 bits each; nothing we expect needs more than 2
+        if (rx_shift < 14) rx_left |= (uint16_t)(c & 0x7F) << rx_shift;
+        rx_shift = (uint8_t)(rx_shift + 7);
+        if (c & 0x80) break;
+        if (rx_left) {
+            rx_st = RX_BODY;
+        } else {
+            rx_done();
+            rx_st = RX_TYPE;
+        }
+        break;
+
+    default:
+        if (rx_n < sizeof(rx_body)) rx_body[rx_n++] = c;
+        if (--rx_left == 0) {
+            rx_done();
+            rx_st = RX_TYPE;
+        }
+        break;
+    }
+}
+
+//SEND
+static char *put_fixed(char *p, uint8_t first, uint16_t rem) {
+    *p++ = (char)first;
+    if (rem < 128) {
+        *p++ = (char)rem;
+    } else {
+        *p++ = (char)((rem & 0x7F) | 0x80);
+        *p++ = (char)(rem >> 7);
+    }
+    return p;
+}
+
+static char *put_u16(char *p, uint16_t v) {
+    *p++ = (char)(v >> 8);
+    *p++ = (char)v;
+    return p;
+}
+
+// UTF-8 string: 2-byte length, then the text
+static char *put_str(char *p, const char *s) {
+    uint8_t n = (uint8_t)strlen(s);
+    p = put_u16(p, n);
+    memcpy(p, s, n);
+    return p + n;
+}
+
+static uint8_t fixed_len(uint16_t rem) {
+    return rem < 128 ? 2 : 3;
+}
+
+static uint16_t topic_len(void) {
+    return (uint16_t)(LIT(TOPIC_1) + strlen(g_channel) + LIT(TOPIC_2));
+}
+
+// Payload half i of `pub`: created_at and the first fields, then the rest
+// and an alert's status
+static uint8_t payload(uint8_t i, char *out) {
+    fmt_t f;
+    uint8_t sep = i ? pub_sep : 0;
+    fmt_init(&f, out, TSREQ_PART_SZ);
+
+    uint32_t t;
+    if (!i && clock_resolve(pub.ts, &t)) {
+        char iso[CLOCK_ISO_LEN + 1];
+        clock_format_iso(t, iso);
+        fmt_P(&f, PSTR("created_at="));
+        fmt_s(&f, iso);
+        sep = 1;
+    }
+    for (uint8_t k = i ? HALF_FIELDS : 0; k < (i ? READING_FIELDS : HALF_FIELDS); k++) {
+        if (pub.f[k] == READING_NONE) continue;
+        if (sep) fmt_c(&f, '&');
+        fmt_P(&f, PSTR("field"));
+        fmt_u(&f, k + 1);
+        fmt_c(&f, '=');
+        tsreq_value(&f, k, pub.f[k]);
+        sep = 1;
+    }
+    if (i && pub.status != READING_ROUTINE) {
+        if (sep) fmt_c(&f, '&');
+        fmt_P(&f, PSTR("status="));
+        fmt_P(&f, level_name_P(pub.status));
+    }
+    return fmt_len(&f);
+}
+
+uint8_t mqtt_parts(uint8_t pkt) {
+    if (pkt == MQTT_CONNECT) return 2;      // header + client id, user + password
+    if (pkt == MQTT_PUBLISH) return 3;      // header + topic, payload x2
+    return 1;
+}
+
+uint16_t mqtt_len(uint8_t pkt) {
+    if (pkt == MQTT_CONNECT) {
+        // "MQTT", level 4, flags, keepalive; then the strings
+        rem_len = (uint16_t)(10 + 2 + strlen(g_id));
+        if (g_user[0]) rem_len += (uint16_t)(2 + strlen(g_user));
+        if (g_pass[0]) rem_len += (uint16_t)(2 + strlen(g_pass));
+    } else if (pkt == MQTT_PUBLISH) {
+        char buf[TSREQ_PART_SZ];
+        if (!store_peek(0, &pub)) pub.ts = 0;
+        // Still the oldest reading: the same packet again, id and all,
+        // flagged DUP. Anything else (an alert took the head) gets a new id.
+        pub_dup = open_on && pub.ts == open_ts && pub.status == open_status;
+        if (MQTT_QOS && !pub_dup && ++pub_id == 0) pub_id = 1;
+        open_on = MQTT_QOS;
+        open_ts = pub.ts;
+        open_status = pub.status;
+        uint8_t head = payload(0, buf);
+        pub_sep = head != 0;
+        rem_len = (uint16_t)(2 + topic_len() + (MQTT_QOS ? 2 : 0) + head + payload(1, buf));
+    } else {
+        rem_len = 0;
+    }
+    return (uint16_t)(fixed_len(rem_len) + rem_len);
+}
+
+uint8_t mqtt_part(uint8_t pkt, uint8_t i, char *out) {
+    char *p = out;
+
+    if (pkt == MQTT_CONNECT) {
+        if (i == 0) {
+            // QoS 1 keeps a persistent session, so the broker still knows
+            // an unacknowledged PUBLISH after a reconnect. QoS 0 has no
+            // session state to keep (and ThingSpeak takes clean ones only).
+            uint8_t flags = MQTT_QOS ? 0x00 : 0x02;
+            if (g_user[0]) flags |= 0x80;
+            if (g_pass[0]) flags |= 0x40;
+            p = put_fixed(p, T_CONNECT << 4, rem_len);
+            p = put_u16(p, 4);
+            memcpy_P(p, PSTR("MQTT"), 4);
+            p += 4;
+            *p++ = 4;                           // protocol level 3.1.1
+            *p++ = (char)flags;
+            p = put_u16(p, MQTT_KEEPALIVE_S);
+            p = put_str(p, g_id);
+        } else {
+            if (g_user[0]) p = put_str(p, g_user);
+            if (g_pass[0]) p = put_str(p, g_pass);
+        }
+    } else if (pkt == MQTT_PUBLISH) {
+        if (i) return payload((uint8_t)(i - 1), out);
+        p = put_fixed(p, (uint8_t)(T_PUBLISH << 4 | pub_dup << 3 | MQTT_QOS << 1), rem_len);
+        p = put_u16(p, topic_len());
+        memcpy_P(p, PSTR(TOPIC_1), LIT(TOPIC_1));
+        p += LIT(TOPIC_1);
+        memcpy(p, g_channel, strlen(g_channel));
+        p += strlen(g_channel);
+        memcpy_P(p, PSTR(TOPIC_2), LIT(TOPIC_2));
+        p += LIT(TOPIC_2);
+        if (MQTT_QOS) p = put_u16(p, pub_id);
+    } else {
+        p = put_fixed(p, T_PINGREQ << 4, 0);
+    }
+    return (uint8_t)(p - out);
+}
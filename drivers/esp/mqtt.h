@@ -0,0 +1,79 @@
+#ifndef MQTT_H
+#define MQTT_H
+
+#include <stdint.h>
+
+// MQTT 3.1.1 client packets for the upload link (ESP_MQTT=1, esp.h).
+//
+// One session per TCP connection (no subscriptions): CONNECT once, then a
+// PUBLISH per reading in store order, and PINGREQ when the link has been
+// quiet for half the keepalive. With MQTT_QOS 1 the session is persistent
+// and a PUBLISH left without PUBACK by a dropped link goes again after the
+// reconnect, same packet id, flagged DUP. A reading
+// goes out as ThingSpeak's MQTT API expects it, as short text on
+// channels/<id>/publish:
+//
+//   created_at=2026-10-17T10:00:00Z&field1=41&field2=40.5&...
+//
+// plus &status=EVACUATE (the new state) for an alert (store.h). That is
+// about 150 bytes with all eight fields, instead of a ~400-byte HTTP
+// request. Like tsreq.c, packets are cut into parts of at most
+// TSREQ_PART_SZ bytes that are generated as the UART TX ring has room.
+
+#ifndef MQTT_HOST
+#define MQTT_HOST "mqtt3.thingspeak.com"
+#endif
+#ifndef MQTT_PORT
+#define MQTT_PORT 1883
+#endif
+
+// 0: a reading is dropped from the store once the ESP sent it (SEND OK).
+// 1: once the broker acknowledged it (PUBACK). ThingSpeak's broker only
+// takes QoS 0 and clean sessions; a broker of your own (mosquitto) can use
+// 1. The client id must then stay the same across resets.
+#ifndef MQTT_QOS
+#define MQTT_QOS 0
+#endif
+
+#ifndef MQTT_KEEPALIVE_S
+#define MQTT_KEEPALIVE_S 60
+#endif
+
+// Packets the client sends
+#define MQTT_CONNECT 0
+#define MQTT_PUBLISH 1      // the oldest reading in the store
+#define MQTT_PINGREQ 2
+
+// Packets received since the last mqtt_clear()
+#define MQTT_EV_CONNACK  (1u << 0)  // session accepted
+#define MQTT_EV_REFUSED  (1u << 1)  // CONNACK with an error code
+#define MQTT_EV_PUBACK   (1u << 2)  // for the last PUBLISH
+#define MQTT_EV_PINGRESP (1u << 3)
+
+// Topic channels/<channel_id>/publish
+void mqtt_init(const char *channel_id);
+
+// client_id, user and pass may be "" (no user name / password sent). The
+// client id goes out in one part with the header, user and password in the
+// next: each part holds TSREQ_PART_SZ bytes.
+void mqtt_set_login(const char *client_id, const char *user, const char *pass);
+
+// New TCP connection: forget partial packets and events
+void mqtt_reset(void);
+
+// A byte the broker sent (the payload of the link's +IPD)
+void mqtt_feed(uint8_t c);
+
+uint8_t mqtt_events(void);
+void mqtt_clear(void);
+
+uint8_t mqtt_parts(uint8_t pkt);
+
+// Total packet length (the AT+CIPSEND argument). Call before the parts:
+// it also fixes the length and packet id they carry.
+uint16_t mqtt_len(uint8_t pkt);
+
+// Part i of packet pkt; returns its length. Parts are binary.
+uint8_t mqtt_part(uint8_t pkt, uint8_t i, char *out);
+
+#endif
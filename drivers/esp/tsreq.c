@@ -0,0 +1,245 @@
+#include "tsreq.h"
+#include "store.h"
+#include "clock.h"
+#include "agg.h"
+#include "fmt.h"
+#include "level.h"
+#include <avr/pgmspace.h>
+#include <string.h>
+
+static const char *g_key = "";
+static const char *g_channel = "";
+static uint8_t g_keepalive = 1;
+
+// Set by tsreq_len(), announced in the headers
+static uint16_t body_len = 0;
+
+// Store index of each bulk row. The store puts an alert, its newest
+// reading, first; the rows go out in created_at order.
+static uint8_t row_of[TSREQ_BULK_MAX];
+
+void tsreq_init(const char *api_key, const char *channel_id, uint8_t keepalive) {
+    g_key = api_key;
+    g_channel = channel_id;
+    g_keepalive = keepalive;
+}
+
+// A bulk field: ,"fieldN":<value right aligned in VALUE_W>
+#define VALUE_W 7
+#define FIELD_W (10 + VALUE_W)
+
+// Fields per reading part: a reading is split in two to keep parts small
+#define HALF_FIELDS (READING_FIELDS / 2)
+
+// Fixed text of a bulk request. The parts send it and tsreq_len() counts
+// it, so the announced length cannot drift from what goes out.
+#define POST_1  "POST /channels/"
+#define POST_2  "/bulk_update.json HTTP/1.1\r\nHost: " TS_HOST "\r\n"
+#define HDR_1   "Connection: "
+#define HDR_2   "\r\nContent-Type: application/json\r\nContent-Length: "
+#define HDR_3   "\r\n\r\n"
+#define HEAD_1  "{\"write_api_key\":\""
+#define HEAD_2  "\",\"updates\":["
+#define ROW_1   "{\"created_at\":\""
+#define ROW_2   "\""
+#define ROW_END "}"
+#define STATUS_1 ",\"status\":\""  // alerts only, store index 0
+#define STATUS_2 "\""
+#define TAIL    "]}"
+#define LIT(s)  (sizeof(s) - 1)
+
+static const char *conn_P(void) {
+    return g_keepalive ? PSTR("keep-alive") : PSTR("close");
+}
+
+void tsreq_value(fmt_t *f, uint8_t k, int16_t v) {
+    if (!(AGG_TENTHS & (1u << k))) {
+        fmt_i(f, v);
+        return;
+    }
+    uint16_t a = (v < 0) ? (uint16_t)(-(int32_t)v) : (uint16_t)v;
+    if (v < 0) fmt_c(f, '-');
+    fmt_u(f, a / 10);
+    fmt_c(f, '.');
+    fmt_u(f, a % 10);
+}
+
+uint8_t tsreq_batch(void) {
+    uint16_t count = store_count();
+    uint8_t n = 0;
+    reading_t r;
+    uint32_t t;
+
+    while (n < TSREQ_BULK_MAX && n < count && store_peek(n, &r) && clock_resolve(r.ts, &t)) n++;
+    return n;
+}
+
+uint8_t tsreq_parts(uint8_t n) {
+    if (!n) return 3;                   // query x2, headers
+    return (uint8_t)(2 * n + 4);        // headers x2, JSON head, readings x2, JSON tail
+}
+
+// Stable insertion sort of the batch by time (the store holds it, and
+// tsreq_batch() checked that every one resolves)
+static void sort_rows(uint8_t n) {
+    uint32_t t[TSREQ_BULK_MAX];
+    reading_t r;
+
+    for (uint8_t j = 0; j < n; j++) {
+        uint32_t tj = 0;
+        uint8_t k = j;
+        if (store_peek(j, &r)) (void)clock_resolve(r.ts, &tj);
+        for (; k && t[k - 1] > tj; k--) {
+            t[k] = t[k - 1];
+            row_of[k] = row_of[k - 1];
+        }
+        t[k] = tj;
+        row_of[k] = j;
+    }
+}
+
+// Fields [from, to) of a reading; JSON pads so the width is fixed
+static void fields(fmt_t *f, const reading_t *r, uint8_t from, uint8_t to, uint8_t json) {
+    for (uint8_t k = from; k < to; k++) {
+        char v[8];
+        fmt_t vf;
+
+        if (r->f[k] == READING_NONE) {
+            if (json) fmt_pad(f, FIELD_W);
+            continue;
+        }
+        fmt_init(&vf, v, sizeof(v));
+        tsreq_value(&vf, k, r->f[k]);
+        if (json) {
+            fmt_P(f, PSTR(",\"field"));
+            fmt_u(f, k + 1);
+            fmt_P(f, PSTR("\":"));
+            fmt_pad(f, (uint8_t)(VALUE_W - fmt_len(&vf)));
+        } else {
+            fmt_P(f, PSTR("&field"));
+            fmt_u(f, k + 1);
+            fmt_c(f, '=');
+        }
+        fmt_s(f, v);
+    }
+}
+
+// JSON body: part 0 = head, 1..2n = readings (two parts each), 2n + 1 = tail
+static uint8_t body_part(uint8_t n, uint8_t i, char *out) {
+    fmt_t f;
+    fmt_init(&f, out, TSREQ_PART_SZ);
+
+    if (i == 0) {
+        fmt_P(&f, PSTR(HEAD_1));
+        fmt_s(&f, g_key);
+        fmt_P(&f, PSTR(HEAD_2));
+        return fmt_len(&f);
+    }
+    if (i > 2 * n) {
+        fmt_P(&f, PSTR(TAIL));
+        return fmt_len(&f);
+    }
+
+    uint8_t j = (uint8_t)((i - 1) / 2);
+    reading_t r = { 0, { 0 }, READING_ROUTINE };
+    (void)store_peek(row_of[j], &r);
+
+    if ((i - 1) & 1) {
+        fields(&f, &r, HALF_FIELDS, READING_FIELDS, 1);
+        if (r.status != READING_ROUTINE) {
+            fmt_P(&f, PSTR(STATUS_1));
+            fmt_P(&f, level_name_P(r.status));
+            fmt_P(&f, PSTR(STATUS_2));
+        }
+        fmt_P(&f, PSTR(ROW_END));
+        return fmt_len(&f);
+    }
+
+    uint32_t t;
+    // tsreq_batch() checked it and the store holds the batch; just in case
+    if (!clock_resolve(r.ts, &t)) t = clock_unix();
+
+    char iso[CLOCK_ISO_LEN + 1];
+    clock_format_iso(t, iso);
+    // Width depends on i only: values are space padded and a missing field
+    // becomes blanks, both of which JSON allows
+    if (j) fmt_c(&f, ',');
+    fmt_P(&f, PSTR(ROW_1));
+    fmt_s(&f, iso);
+    fmt_P(&f, PSTR(ROW_2));
+    fields(&f, &r, 0, HALF_FIELDS, 1);
+    return fmt_len(&f);
+}
+
+// GET /update: parts 0-1 = query, 2 = the rest
+static uint8_t get_part(uint8_t i, char *out) {
+    fmt_t f;
+    reading_t r;
+    fmt_init(&f, out, TSREQ_PART_SZ);
+
+    if (i == 2) {
+        fmt_P(&f, PSTR(" HTTP/1.1\r\nHost: " TS_HOST "\r\n" HDR_1));
+        fmt_P(&f, conn_P());
+        fmt_P(&f, PSTR(HDR_3));
+    } else if (store_peek(0, &r)) {
+        if (i == 0) {
+            fmt_P(&f, PSTR("GET /update?api_key="));
+            fmt_s(&f, g_key);
+        }
+        fields(&f, &r, i ? HALF_FIELDS : 0, i ? READING_FIELDS : HALF_FIELDS, 0);
+        if (i && r.status != READING_ROUTINE) {
+            fmt_P(&f, PSTR("&status="));
+            fmt_P(&f, level_name_P(r.status));
+        }
+    }
+    return fmt_len(&f);
+}
+
+uint8_t tsreq_part(uint8_t n, uint8_t i, char *out) {
+    if (n == 0) return get_part(i, out);
+
+    fmt_t f;
+    fmt_init(&f, out, TSREQ_PART_SZ);
+    if (i == 0) {
+        fmt_P(&f, PSTR(POST_1));
+        fmt_s(&f, g_channel);
+        fmt_P(&f, PSTR(POST_2));
+        return fmt_len(&f);
+    }
+    if (i == 1) {
+        fmt_P(&f, PSTR(HDR_1));
+        fmt_P(&f, conn_P());
+        fmt_P(&f, PSTR(HDR_2));
+        fmt_u(&f, body_len);
+        fmt_P(&f, PSTR(HDR_3));
+        return fmt_len(&f);
+    }
+    return body_part(n, (uint8_t)(i - 2), out);
+}
+
+uint16_t tsreq_len(uint8_t n) {
+    if (n == 0) {
+        // A GET carries values of varying width: measure it
+        char buf[TSREQ_PART_SZ];
+        uint16_t len = 0;
+        for (uint8_t i = 0; i < tsreq_parts(0); i++) len += get_part(i, buf);
+        return len;
+    }
+
+    // Bulk parts have fixed widths, so the length is counted, not built.
+    // An alert's status is fixed too: it stays at the head until popped.
+    sort_rows(n);
+    reading_t r;
+    uint16_t status = 0;
+    if (store_peek(0, &r) && r.status != READING_ROUTINE) {
+        status = (uint16_t)(LIT(STATUS_1) + strlen_P(level_name_P(r.status)) + LIT(STATUS_2));
+    }
+    body_len = (uint16_t)(LIT(HEAD_1) + strlen(g_key) + LIT(HEAD_2)
+                          + n * (LIT(ROW_1) + CLOCK_ISO_LEN + LIT(ROW_2)
+                                 + READING_FIELDS * FIELD_W + LIT(ROW_END))
+                          + (n - 1)                 // commas between readings
+                          + status + LIT(TAIL));
+    return (uint16_t)(LIT(POST_1) + strlen(g_channel) + LIT(POST_2)
+                      + LIT(HDR_1) + strlen_P(conn_P()) + LIT(HDR_2)
+                      + fmt_digits(body_len) + LIT(HDR_3) + body_len);
+}
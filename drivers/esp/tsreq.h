@@ -0,0 +1,50 @@
+#ifndef TSREQ_H
+#define TSREQ_H
+
+#include <stdint.h>
+#include "fmt.h"
+
+// ThingSpeak HTTP requests for the oldest readings in the store (store.h).
+//
+// A batch of n >= 1 readings goes out as one POST to the bulk_update.json
+// endpoint, each with its own created_at. n == 0 means the oldest reading
+// has no usable timestamp (clock never synced); it is sent alone as a plain
+// GET /update and ThingSpeak stamps it on arrival. An alert, always the
+// first reading taken, also carries "status": the state it reports. The
+// rows of a bulk request are in time order, the alert's among them.
+//
+// A full bulk request is ~2 KB, so it is never built in SRAM: it is cut
+// into parts of at most TSREQ_PART_SZ bytes that are generated one by one as
+// the UART TX ring has room, so the store must not change under a request
+// (the uploader holds the batch, store_hold). The width of a bulk part also
+// depends only on its position.
+
+#define TS_HOST "api.thingspeak.com"
+
+// Readings per bulk request: ~175 bytes each with all eight fields, within
+// the ESP's 2048-byte CIPSEND limit
+#ifndef TSREQ_BULK_MAX
+#define TSREQ_BULK_MAX 10
+#endif
+
+// Largest part, including the terminating NUL. Must fit the UART TX ring.
+#define TSREQ_PART_SZ 112
+
+void tsreq_init(const char *api_key, const char *channel_id, uint8_t keepalive);
+
+// How many of the oldest readings the next request carries (see above)
+uint8_t tsreq_batch(void);
+
+uint8_t tsreq_parts(uint8_t n);
+
+// Total request length (the AT+CIPSEND argument). Call before the parts:
+// it also fixes the Content-Length they announce and the order of the rows.
+uint16_t tsreq_len(uint8_t n);
+
+// Part i of the request for a batch of n; returns its length
+uint8_t tsreq_part(uint8_t n, uint8_t i, char *out);
+
+// Value of field k (0-based) as text: tenths get one decimal (agg.h)
+void tsreq_value(fmt_t *f, uint8_t k, int16_t v);
+
+#endif
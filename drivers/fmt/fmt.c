@@ -0,0 +1,79 @@
+#include "fmt.h"
+#include <avr/pgmspace.h>
+
+void fmt_init(fmt_t *f, char *buf, uint8_t size) {
+    f->buf = buf;
+    f->p = buf;
+    f->end = buf + size - 1;
+    *buf = '\0';
+}
+
+uint8_t fmt_len(const fmt_t *f) {
+    return (uint8_t)(f->p - f->buf);
+}
+
+void fmt_c(fmt_t *f, char c) {
+    if (f->p < f->end) *f->p++ = c;
+    *f->p = '\0';
+}
+
+void fmt_s(fmt_t *f, const char *s) {
+    while (*s && f->p < f->end) *f->p++ = *s++;
+    *f->p = '\0';
+}
+
+void fmt_P(fmt_t *f, const char *p) {
+    char c;
+    while (f->p < f->end && (c = (char)pgm_read_byte(p++))) *f->p++ = c;
+    *f->p = '\0';
+}
+
+void fmt_pad(fmt_t *f, uint8_t n) {
+    while (n-- && f->p < f->end) *f->p++ = ' ';
+    *f->p = '\0';
+}
+
+// Digits of v into tmp, least significant first; returns how many
+static uint8_t digits_rev(char *tmp, uint32_t v) {
+    uint8_t n = 0;
+
+    // 32-bit division costs several times a 16-bit one on the AVR: only
+    // while the value needs it
+    while (v > 0xFFFFUL) {
+        tmp[n++] = (char)('0' + (uint8_t)(v % 10));
+        v /= 10;
+    }
+    uint16_t w = (uint16_t)v;
+    do {
+        tmp[n++] = (char)('0' + (uint8_t)(w % 10));
+        w /= 10;
+    } while (w);
+    return n;
+}
+
+void fmt_u_w(fmt_t *f, uint32_t v, uint8_t w) {
+    char tmp[10];
+    uint8_t n = digits_rev(tmp, v);
+
+    if (w > n) fmt_pad(f, (uint8_t)(w - n));
+    while (n && f->p < f->end) *f->p++ = tmp[--n];
+    *f->p = '\0';
+}
+
+void fmt_u(fmt_t *f, uint32_t v) {
+    fmt_u_w(f, v, 0);
+}
+
+void fmt_i(fmt_t *f, int32_t v) {
+    if (v < 0) {
+        fmt_c(f, '-');
+        fmt_u(f, (uint32_t)(-(v + 1)) + 1);
+    } else {
+        fmt_u(f, (uint32_t)v);
+    }
+}
+
+uint8_t fmt_digits(uint32_t v) {
+    char tmp[10];
+    return digits_rev(tmp, v);
+}
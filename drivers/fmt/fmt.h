@@ -0,0 +1,36 @@
+#ifndef FMT_H
+#define FMT_H
+
+#include <stdint.h>
+
+// Text builder in place of snprintf, which would pull vfprintf into the
+// firmware: decimal integers, optionally right aligned in a fixed field,
+// and strings from RAM or flash, appended to a caller's buffer. Output is
+// cut at the end of the buffer and always NUL terminated.
+
+typedef struct {
+    char *buf;
+    char *p;        // the terminating NUL
+    char *end;      // last byte of buf, kept for the NUL
+} fmt_t;
+
+void fmt_init(fmt_t *f, char *buf, uint8_t size);
+
+// Characters so far
+uint8_t fmt_len(const fmt_t *f);
+
+void fmt_c(fmt_t *f, char c);
+void fmt_s(fmt_t *f, const char *s);
+void fmt_P(fmt_t *f, const char *p);    // string in flash (PSTR)
+void fmt_pad(fmt_t *f, uint8_t n);      // n spaces
+
+void fmt_u(fmt_t *f, uint32_t v);
+void fmt_i(fmt_t *f, int32_t v);
+
+// v right aligned in a field of w chars (a wider value is not cut)
+void fmt_u_w(fmt_t *f, uint32_t v, uint8_t w);
+
+// Decimal digits of v: the length of a number before it is written
+uint8_t fmt_digits(uint32_t v);
+
+#endif
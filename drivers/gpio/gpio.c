@@ -7,7 +7,10 @@ void gpio_init(void) {
 
     // TRIG output on PD7
     TRIG_DDR  |= (1 << TRIG_BIT);
-    trig_low();
+    trig_low(0);
+
+    // ESP RST released (input)
+    esp_rst_release();
 }
 
 void leds_all_off(void) {
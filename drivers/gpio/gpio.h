@@ -11,11 +11,28 @@
 #define LED2_BIT   PD5   // PREPARE  (Yellow)
 #define LED3_BIT   PD6   // SAFE     (Green)
 
-// Ultrasonic TRIG = D7 = PD7
+// Ultrasonic sensors (sensor.h), sensor 0 first:
+//   TRIG: D7 = PD7, then A0..A2 = PC0..PC2
+//   ECHO: D8..D11 = PB0..PB3, all on one pin-change interrupt (PCINT0)
 #define TRIG_DDR   DDRD
 #define TRIG_PORT  PORTD
 #define TRIG_BIT   PD7
 
+#define TRIGX_DDR  DDRC         // sensors 1..3
+#define TRIGX_PORT PORTC
+#define TRIGX_BIT(i)  (PC0 + (i) - 1)
+
+#define ECHO_DDR   DDRB
+#define ECHO_PORT  PORTB
+#define ECHO_PIN   PINB
+#define ECHO_BIT(i)   (PB0 + (i))
+
+// ESP8266 RST (active low) = D2 = PD2. Driven low only to reset; otherwise
+// an input, so the ESP's own pull-up holds it at 3.3 V, never 5 V.
+#define ESP_RST_DDR   DDRD
+#define ESP_RST_PORT  PORTD
+#define ESP_RST_BIT   PD2
+
 void gpio_init(void);
 
 //LED Helpers
@@ -27,8 +44,24 @@ void leds_set_safe(void);     // LED3
 // Update LEDs based on distance in cm
 void leds_update_by_distance(int16_t cm);
 
-// Trigger helpers
-static inline void trig_low(void){ TRIG_PORT &= ~(1 << TRIG_BIT); }
-static inline void trig_high(void){ TRIG_PORT |=  (1 << TRIG_BIT); }
+// ESP reset helpers
+static inline void esp_rst_assert(void){
+    ESP_RST_PORT &= ~(1 << ESP_RST_BIT);
+    ESP_RST_DDR  |=  (1 << ESP_RST_BIT);
+}
+static inline void esp_rst_release(void){
+    ESP_RST_DDR  &= ~(1 << ESP_RST_BIT);
+    ESP_RST_PORT &= ~(1 << ESP_RST_BIT);  // no pull-up
+}
+
+// Trigger helpers, sensor i
+static inline void trig_low(uint8_t i){
+    if (i) TRIGX_PORT &= ~(1 << TRIGX_BIT(i));
+    else   TRIG_PORT  &= ~(1 << TRIG_BIT);
+}
+static inline void trig_high(uint8_t i){
+    if (i) TRIGX_PORT |= (1 << TRIGX_BIT(i));
+    else   TRIG_PORT  |= (1 << TRIG_BIT);
+}
 
 #endif
\ No newline at end of file
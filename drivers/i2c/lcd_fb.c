@@ -0,0 +1,114 @@
+#include "lcd_fb.h"
+#include "lcd_i2c.h"
+#include <avr/pgmspace.h>
+#include <string.h>
+
+// want  = what the application composed
+// shown = what the HD44780 holds (0 = unknown, never a printable char)
+static char want[LCD_FB_ROWS][LCD_FB_COLS];
+static char shown[LCD_FB_ROWS][LCD_FB_COLS];
+static uint8_t dirty = 0;
+
+// Where the display's address counter points; valid only if cur_ok
+static uint8_t cur_row = 0;
+static uint8_t cur_col = 0;
+static uint8_t cur_ok = 0;
+
+static uint16_t seen_errors = 0;
+
+void lcd_fb_init(void) {
+    memset(want, ' ', sizeof(want));
+    memset(shown, ' ', sizeof(shown));
+    dirty = 0;
+    cur_ok = 0;
+    seen_errors = lcd_errors();
+}
+
+void lcd_fb_invalidate(void) {
+    memset(shown, 0, sizeof(shown));
+    cur_ok = 0;
+    dirty = 1;
+}
+
+static void set_row(uint8_t row, const char *s, uint8_t flash) {
+    if (row >= LCD_FB_ROWS) return;
+
+    char *w = want[row];
+    uint8_t i = 0;
+    if (s) {
+        for (; i < LCD_FB_COLS; i++) {
+            char c = flash ? (char)pgm_read_byte(s + i) : s[i];
+            if (!c) break;
+            w[i] = c;
+        }
+    }
+    for (; i < LCD_FB_COLS; i++) w[i] = ' ';
+
+    if (memcmp(want[row], shown[row], LCD_FB_COLS) != 0) dirty = 1;
+}
+
+void lcd_fb_set_row(uint8_t row, const char *s) {
+    set_row(row, s, 0);
+}
+
+void lcd_fb_set_row_P(uint8_t row, const char *p) {
+    set_row(row, p, 1);
+}
+
+void lcd_fb_set_cell(uint8_t row, uint8_t col, char c) {
+    if (row >= LCD_FB_ROWS || col >= LCD_FB_COLS) return;
+    want[row][col] = c;
+    if (shown[row][col] != c) dirty = 1;
+}
+
+uint8_t lcd_fb_flush(void) {
+    // A lost byte means the display may differ from `shown`: redraw all
+    uint16_t e = lcd_errors();
+    if (e != seen_errors) {
+        seen_errors = e;
+        lcd_fb_invalidate();
+    }
+
+    if (!dirty) return 0;
+
+    uint8_t written = 0;
+
+    // The whole diff goes out as one I2C transaction
+    lcd_batch_begin();
+
+    for (uint8_t r = 0; r < LCD_FB_ROWS; r++) {
+        for (uint8_t c = 0; c < LCD_FB_COLS; c++) {
+            if (want[r][c] == shown[r][c]) continue;
+
+            uint8_t here = cur_ok && cur_row == r;
+            if (here && cur_col + 1 == c && shown[r][cur_col]) {
+                // One unchanged cell in between: rewriting it costs the same
+                // as a cursor move and keeps RS on data.
+                if (!lcd_putc(shown[r][cur_col])) goto lost;
+                cur_col++;
+            } else if (!here || cur_col != c) {
+                if (!lcd_set_cursor(c, r)) goto lost;
+                cur_ok = 1;
+                cur_row = r;
+                cur_col = c;
+            }
+
+            if (!lcd_putc(want[r][c])) goto lost;
+            shown[r][c] = want[r][c];
+            cur_col++;
+            written++;
+        }
+    }
+
+    lcd_batch_end();
+    dirty = 0;
+    return written;
+
+lost:
+    // Queue full or bus down: nothing of the failed write reached the bus,
+    // so only the cursor is in doubt. Keep the rest for the next flush.
+    lcd_batch_end();
+    cur_ok = 0;
+    seen_errors++;
+    return written;
+}
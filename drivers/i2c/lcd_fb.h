@@ -0,0 +1,31 @@
+#ifndef LCD_FB_H
+#define LCD_FB_H
+
+#include <stdint.h>
+
+// 2x16 shadow framebuffer for the HD44780.
+// Rows are composed in RAM; lcd_fb_flush() sends only the cells that differ
+// from what the display currently shows and never issues a clear.
+
+#define LCD_FB_ROWS 2
+#define LCD_FB_COLS 16
+
+// Call once after lcd_init(); flush only once lcd_task() reports ready
+void lcd_fb_init(void);
+
+// Set a whole row (pads with spaces / truncates to 16)
+void lcd_fb_set_row(uint8_t row, const char *s);
+
+// Same, with the string in flash (PSTR)
+void lcd_fb_set_row_P(uint8_t row, const char *p);
+
+// One cell, e.g. a status mark over a row set just before
+void lcd_fb_set_cell(uint8_t row, uint8_t col, char c);
+
+// Forget what the display shows; next flush redraws every cell
+void lcd_fb_invalidate(void);
+
+// Push pending changes. Returns number of cells written.
+uint8_t lcd_fb_flush(void);
+
+#endif
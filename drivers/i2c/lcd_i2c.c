@@ -1,6 +1,8 @@
 #include "lcd_i2c.h"
 #include "twi.h"
+#include "timebase.h"
 #include <util/delay.h>
+#include <avr/pgmspace.h>
 #include <string.h>
 
 #define LCD_ADDR 0x27
@@ -15,26 +17,48 @@
 #define PIN_D6  (1 << 6)
 #define PIN_D7  (1 << 7)
 
+// Bus clock. The PCF8574 is specified for 100 kHz but the common LCD
+// backpacks run fine at 400 kHz; build with -DLCD_I2C_HZ=100000 if not.
+#ifndef LCD_I2C_HZ
+#define LCD_I2C_HZ 400000UL
+#endif
+
 static uint8_t backlight = PIN_BL;
+static uint16_t lcd_drops = 0;
 
-static void expander_write(uint8_t data) {
-    if (!twi_start((LCD_ADDR << 1) | 0)) {
-        twi_stop();
-        return;
-    }
-    (void)twi_write(data | backlight);
-    twi_stop();
+// Streaming: consecutive LCD bytes are packed into one open TWI transaction.
+// Per nibble the expander gets [D|EN][D]; the HD44780 latches on the EN
+// falling edge. One byte on the wire is 22.5 us at 400 kHz (90 us at
+// 100 kHz), so the EN pulse is far wider than 450 ns, and the two bytes
+// between one character's last falling edge and the next one's (45 us)
+// cover the 37 us execution time. No CPU delays needed.
+static uint8_t batch = 0;       // lcd_batch_begin() nesting
+static uint8_t open_tx = 0;     // a TWI transaction is open
+static uint8_t cur_rs = 0;      // RS level of the last byte in it
+
+// A power-on step or clear/home needs the LCD left alone for settle_ms after
+// its bytes left the bus. Nothing is sent until then; callers retry later.
+static uint8_t settle_ms = 0;
+static uint8_t settle_q = 0;    // the timer starts once the TWI queue drained
+static uint32_t settle_t = 0;
+
+static void settle(uint8_t ms) {
+    settle_ms = ms;
+    settle_q = ms != 0;
 }
 
-static void pulse_enable(uint8_t data) {
-    expander_write(data | PIN_EN);
-    _delay_us(1);
-    expander_write(data & ~PIN_EN);
-    _delay_us(50);
+static uint8_t settled(void) {
+    if (settle_q) {
+        if (twi_busy()) return 0;
+        settle_q = 0;
+        settle_t = millis();
+    }
+    // More than settle_ms ticks: at least settle_ms whole ms
+    return !settle_ms || millis() - settle_t > settle_ms;
 }
 
-static void write4(uint8_t nibble, uint8_t rs) {
-    uint8_t data = 0;
+static uint8_t bus_byte(uint8_t nibble, uint8_t rs) {
+    uint8_t data = backlight;
 
     if (rs) data |= PIN_RS; // RS=1 data, RS=0 cmd
     // RW=0 always
@@ -43,68 +67,239 @@ static void write4(uint8_t nibble, uint8_t rs) {
     if (nibble & 0x02) data |= PIN_D5;
     if (nibble & 0x04) data |= PIN_D6;
     if (nibble & 0x08) data |= PIN_D7;
+    return data;
+}
 
-    expander_write(data);
-    pulse_enable(data);
+static void stream_end(void) {
+    if (open_tx) {
+        twi_write_end();
+        open_tx = 0;
+    }
 }
 
-static void lcd_send(uint8_t value, uint8_t rs) {
-    write4((value >> 4) & 0x0F, rs);
-    write4(value & 0x0F, rs);
+// Make sure the open transaction can take `need` more bytes, starting a new
+// one if necessary. Returns 2 if a new transaction was opened, 1 if the
+// current one has room, 0 if the bytes must be dropped. Never waits: the main
+// loop outruns the UART RX ring within a few ms, so a full queue or a stuck
+// bus drops the bytes and lcd_fb redraws them on its next flush.
+static uint8_t stream_room(uint8_t need) {
+    if (open_tx && twi_write_room() >= need) return 1;
+    stream_end();
+
+    if (!settled() || twi_free() < (uint8_t)(need + 2)) return 0;
+    if (!twi_write_begin(LCD_ADDR)) return 0;
+    open_tx = 1;
+    return 2;
 }
 
-static void lcd_cmd(uint8_t cmd) {
-    lcd_send(cmd, 0);
-    if (cmd == 0x01 || cmd == 0x02) _delay_ms(2);
+// Queue one full LCD byte (two nibbles)
+static uint8_t lcd_send(uint8_t value, uint8_t rs) {
+    uint8_t r = stream_room(5);
+    if (!r) {
+        lcd_drops++;
+        return 0;
+    }
+
+    uint8_t hi = bus_byte(value >> 4, rs);
+    uint8_t lo = bus_byte(value & 0x0F, rs);
+
+    // RS must settle before EN rises: one setup byte when it changes
+    if (r == 2 || cur_rs != rs) twi_write_byte(hi);
+    twi_write_byte(hi | PIN_EN);
+    twi_write_byte(hi);
+    twi_write_byte(lo | PIN_EN);
+    twi_write_byte(lo);
+    cur_rs = rs;
+
+    if (!batch) stream_end();
+    return 1;
 }
 
-static void lcd_data(uint8_t d) {
-    lcd_send(d, 1);
+static uint8_t lcd_cmd(uint8_t cmd) {
+    uint8_t ok = lcd_send(cmd, 0);
+    if (cmd == 0x01 || cmd == 0x02) {
+        // clear/home need 1.52 ms after the command actually reaches the LCD
+        stream_end();
+        if (ok) settle(2);
+    }
+    return ok;
 }
 
-void lcd_init(void) {
-    twi_init(100000);
-    _delay_ms(50);
+static uint8_t lcd_data(uint8_t d) {
+    return lcd_send(d, 1);
+}
+
+void lcd_batch_begin(void) {
+    batch++;
+}
+
+void lcd_batch_end(void) {
+    if (batch && --batch == 0) stream_end();
+}
+
+static uint8_t init_nibble(uint8_t nibble) {
+    uint8_t d = bus_byte(nibble, 0);
+    if (!stream_room(3)) return 0;
+    twi_write_byte(d);
+    twi_write_byte(d | PIN_EN);
+    twi_write_byte(d);
+    stream_end();
+    return 1;
+}
+
+// Power-on sequence, stepped by lcd_task() so nothing else waits for it:
+// { nibble or command, ms before the next step }. Delays are rounded up to
+// whole milliseconds (150 us -> 1 ms) and measured from when the step's bytes
+// left the bus. A step that finds no room in the TWI queue is retried.
+#define INIT_NIBBLE 0x80
+#define INIT_POWER_MS 50    // from VCC rising to the first nibble
 
-    // Init 4-bit mode sequence
-    write4(0x03, 0);
-    _delay_ms(5);
-    write4(0x03, 0);
-    _delay_us(150);
-    write4(0x03, 0);
-    _delay_us(150);
+static const uint8_t init_seq[][2] PROGMEM = {
+    { INIT_NIBBLE | 0x03, 5 },
+    { INIT_NIBBLE | 0x03, 1 },
+    { INIT_NIBBLE | 0x03, 1 },
+    { INIT_NIBBLE | 0x02, 1 },  // 4-bit
+    { 0x28, 0 },                // 4-bit, 2 line, 5x8
+    { 0x08, 0 },                // display off
+    { 0x01, 2 },                // clear
+    { 0x06, 0 },                // entry mode
+    { 0x0C, 0 },                // display on, cursor off, blink off
+};
+#define INIT_STEPS (sizeof(init_seq) / sizeof(init_seq[0]))
 
-    write4(0x02, 0); // 4-bit
-    _delay_us(150);
+static uint8_t init_step = INIT_STEPS;
 
-    lcd_cmd(0x28); // 4-bit, 2 line, 5x8
-    lcd_cmd(0x08); // display off
-    lcd_cmd(0x01); // clear
-    lcd_cmd(0x06); // entry mode
-    lcd_cmd(0x0C); // display on, cursor off, blink off
+void lcd_init(void) {
+    twi_init(LCD_I2C_HZ);
+    init_step = 0;
+    settle(INIT_POWER_MS);
+}
+
+uint8_t lcd_task(void) {
+    while (init_step < INIT_STEPS) {
+        if (!settled()) return 0;
+
+        uint8_t op = pgm_read_byte(&init_seq[init_step][0]);
+        uint8_t ok = (op & INIT_NIBBLE) ? init_nibble(op & 0x0F) : lcd_send(op, 0);
+        if (!ok) return 0;
+        settle(pgm_read_byte(&init_seq[init_step][1]));
+        init_step++;
+    }
+    return 1;
 }
 
 void lcd_clear(void) {
-    lcd_cmd(0x01);
+    (void)lcd_cmd(0x01);
 }
 
-void lcd_set_cursor(uint8_t col, uint8_t row) {
+uint8_t lcd_set_cursor(uint8_t col, uint8_t row) {
     static const uint8_t row_offsets[] = {0x00, 0x40};
     if (row > 1) row = 1;
-    lcd_cmd(0x80 | (row_offsets[row] + col));
+    return lcd_cmd(0x80 | (row_offsets[row] + col));
+}
+
+uint8_t lcd_putc(char c) {
+    return lcd_data((uint8_t)c);
+}
+
+uint16_t lcd_errors(void) {
+    twi_stats_t ts;
+    twi_get_stats(&ts);
+    return (uint16_t)(lcd_drops + ts.dropped);
 }
 
 void lcd_print(const char *s) {
-    while (*s) lcd_data((uint8_t)*s++);
+    lcd_batch_begin();
+    while (*s) (void)lcd_data((uint8_t)*s++);
+    lcd_batch_end();
 }
 
-void lcd_print_16(const char *s) {
-    char buf[17];
-    for (uint8_t i = 0; i < 16; i++) buf[i] = ' ';
-    buf[16] = '\0';
+static void print_16(const char *s, uint8_t flash) {
+    uint8_t i = 0;
 
+    lcd_batch_begin();
     if (s) {
-        for (uint8_t i = 0; i < 16 && s[i]; i++) buf[i] = s[i];
+        for (; i < 16; i++) {
+            char c = flash ? (char)pgm_read_byte(s + i) : s[i];
+            if (!c) break;
+            (void)lcd_data((uint8_t)c);
+        }
+    }
+    for (; i < 16; i++) (void)lcd_data(' ');
+    lcd_batch_end();
+}
+
+void lcd_print_16(const char *s) {
+    print_16(s, 0);
+}
+
+void lcd_print_16_P(const char *p) {
+    print_16(p, 1);
+}
+
+#ifdef LCD_BENCH
+#include "uart.h"
+#include "fmt.h"
+
+#define BENCH_N 50
+#define LCD_WAIT_MS 30
+
+// The pre-streaming path, reproduced for comparison: every nibble as three
+// separate single-byte transactions, each waited for, plus the old 1 us /
+// 50 us enable delays.
+static void legacy_print_16(const char *s) {
+    for (uint8_t i = 0; i < 16; i++) {
+        uint8_t c = ' ';
+        if (*s) c = (uint8_t)*s++;
+
+        for (uint8_t n = 0; n < 2; n++) {
+            uint8_t d = bus_byte(n ? (c & 0x0F) : (c >> 4), 1);
+            uint8_t seq[3] = { d, (uint8_t)(d | PIN_EN), d };
+
+            for (uint8_t k = 0; k < 3; k++) {
+                twi_queue_write(LCD_ADDR, &seq[k], 1);
+                (void)twi_flush(LCD_WAIT_MS);
+                if (k == 1) _delay_us(1);
+                if (k == 2) _delay_us(50);
+            }
+        }
+    }
+}
+
+// Wall time per lcd_print_16, measured until the last byte left the bus
+static uint32_t bench_us(uint8_t legacy) {
+    static const char text[] = "Level: 123 cm";
+
+    uint32_t t0 = micros();
+    for (uint8_t n = 0; n < BENCH_N; n++) {
+        if (legacy) legacy_print_16(text);
+        else lcd_print_16(text);
+        (void)twi_flush(LCD_WAIT_MS);
     }
-    lcd_print(buf);
+    return (micros() - t0) / BENCH_N;
+}
+
+void lcd_bench(void) {
+    while (!lcd_task()) {}
+
+    twi_init(100000);
+    uint32_t before = bench_us(1);
+
+    twi_init(LCD_I2C_HZ);
+    uint32_t after = bench_us(0);
+
+    lcd_clear();
+
+    char line[72];
+    fmt_t f;
+    fmt_init(&f, line, sizeof(line));
+    fmt_P(&f, PSTR("lcd_print_16: before "));
+    fmt_u(&f, before);
+    fmt_P(&f, PSTR(" us, after "));
+    fmt_u(&f, after);
+    fmt_P(&f, PSTR(" us ("));
+    fmt_u(&f, after ? before / after : 0);
+    fmt_P(&f, PSTR("x)\r\n"));
+    uart_puts(line);
 }
+#endif
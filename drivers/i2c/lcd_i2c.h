@@ -3,13 +3,38 @@
 
 #include <stdint.h>
 
+// Starts the power-on sequence and returns at once; lcd_task() carries it
+// out. Needs the millis() tick running.
 void lcd_init(void);
+
+// Call every few ms. Returns 1 once the display is initialised; nothing
+// may be printed before that.
+uint8_t lcd_task(void);
+
 void lcd_clear(void);
 
-void lcd_set_cursor(uint8_t col, uint8_t row); // row: 0 or 1
+// Return 1 if the bytes were queued to the TWI engine, 0 if dropped
+uint8_t lcd_set_cursor(uint8_t col, uint8_t row); // row: 0 or 1
+uint8_t lcd_putc(char c);
 void lcd_print(const char *s);
 
 // Print exactly 16 chars (pads with spaces / truncates)
 void lcd_print_16(const char *s);
+void lcd_print_16_P(const char *p);     // string in flash (PSTR)
+
+// Everything sent between begin and end goes out as one I2C transaction
+// (split only if it outgrows the TWI ring). Calls nest.
+void lcd_batch_begin(void);
+void lcd_batch_end(void);
+
+// Bytes lost on the way to the display (queue full, NACK, bus timeout).
+// Any change means the screen may no longer match what was sent.
+uint16_t lcd_errors(void);
+
+#ifdef LCD_BENCH
+// Times lcd_print_16 on the old per-nibble path vs the streamed one and
+// prints both over the UART (make bench-lcd)
+void lcd_bench(void);
+#endif
 
 #endif
@@ -0,0 +1,74 @@
+#include "level.h"
+#include <avr/pgmspace.h>
+
+void level_init(level_t *lv) {
+    median_init(&lv->filt);
+    lv->confirm = CONFIDENCE_THRESHOLD;
+    lv->pending_state = STATE_SAFE;
+    lv->stability_counter = 0;
+    lv->active_state = STATE_SAFE;
+    lv->stable_cm = -1;
+    lv->live = 0;
+}
+
+uint8_t level_valid(int16_t raw_cm) {
+    return raw_cm > 0 && raw_cm <= LEVEL_VALID_MAX_CM;
+}
+
+//CLASSIFICATION 
+uint8_t level_classify(int16_t cm) {
+    if (cm < 0) return STATE_SAFE;
+    if (cm <= LEVEL_EVAC_MAX_CM) return STATE_EVAC;
+    if (cm <= LEVEL_PREPARE_MAX_CM) return STATE_PREPARE;
+    return STATE_SAFE;
+}
+
+uint8_t level_update(level_t *lv, int16_t raw_cm) {
+    //Mathematical Smoothing
+    // Rejected sample: window unchanged, so is its median
+    if (!level_valid(raw_cm)) lv->stable_cm = median_get(&lv->filt);
+    else lv->stable_cm = median_push(&lv->filt, raw_cm);
+
+    //Check which state this value BELONGS to
+    uint8_t detected_state = level_classify(lv->stable_cm);
+
+    // Confidence Check 
+    uint8_t need = lv->confirm;
+    if (!lv->live && need > LEVEL_BOOT_CONFIRM) need = LEVEL_BOOT_CONFIRM;
+    if (detected_state == lv->pending_state) {
+        if (lv->stability_counter < need) {
+            lv->stability_counter++;
+        } else {
+            // Confirmed! Update the REAL state
+            lv->active_state = lv->pending_state;
+            if (lv->stable_cm >= 0) lv->live = 1;
+        }
+    } else {
+        // Fluke or Change? Reset and wait for proof
+        lv->pending_state = detected_state;
+        lv->stability_counter = 0;
+    }
+
+    return lv->active_state;
+}
+
+static const char label_safe[] PROGMEM    = "      SAFE      ";
+static const char label_prepare[] PROGMEM = "     PREPARE    ";
+static const char label_evac[] PROGMEM    = "    EVACUATE    ";
+
+const char *level_label_P(uint8_t state) {
+    switch(state) {
+        case STATE_EVAC:    return label_evac;
+        case STATE_PREPARE: return label_prepare;
+        case STATE_SAFE:    return label_safe;
+        default:            return label_safe;
+    }
+}
+
+const char *level_name_P(uint8_t state) {
+    switch(state) {
+        case STATE_EVAC:    return PSTR("EVACUATE");
+        case STATE_PREPARE: return PSTR("PREPARE");
+        default:            return PSTR("SAFE");
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef LEVEL_H
+#define LEVEL_H
+
+#include <stdint.h>
+#include "median.h"
+
+// Decision pipeline: raw ultrasonic cm -> median filter -> instant class ->
+// confidence/debounce -> confirmed state. Pure logic, no hardware access.
+
+//STATE DEFINITIONS
+#define STATE_SAFE      0
+#define STATE_PREPARE   1
+#define STATE_EVAC      2
+
+// Distance sensor -> water (cm). Smaller means higher water.
+#ifndef LEVEL_EVAC_MAX_CM
+#define LEVEL_EVAC_MAX_CM     29   // 0-29 cm
+#endif
+#ifndef LEVEL_PREPARE_MAX_CM
+#define LEVEL_PREPARE_MAX_CM  33   // 30-33 cm
+#endif
+
+// Readings outside 1..LEVEL_VALID_MAX_CM are rejected before the filter
+#define LEVEL_VALID_MAX_CM    400
+
+// 30 consistent samples required to switch: ~0.7 s at the full ping rate
+// used near the thresholds (ping.h)
+#ifndef CONFIDENCE_THRESHOLD
+#define CONFIDENCE_THRESHOLD 30
+#endif
+
+// Until a state is confirmed from real readings the station has nothing to
+// show, so the first one needs only this many: ~0.2 s after power-on
+#ifndef LEVEL_BOOT_CONFIRM
+#define LEVEL_BOOT_CONFIRM 8
+#endif
+
+typedef struct {
+    median_t filt;
+    uint8_t confirm;            // CONFIDENCE_THRESHOLD unless tuned at runtime
+    uint8_t pending_state;
+    uint8_t stability_counter;
+    uint8_t active_state;       // confirmed state
+    int16_t stable_cm;          // filtered level, -1 until the first valid reading
+    uint8_t live;               // active_state is backed by readings
+} level_t;
+
+void level_init(level_t *lv);
+
+// 1 if a raw reading is a usable distance (not a timeout / out of range)
+uint8_t level_valid(int16_t raw_cm);
+
+// Instant class of one filtered reading
+uint8_t level_classify(int16_t cm);
+
+// Feed one raw reading (-1 = timeout). Returns the confirmed state.
+uint8_t level_update(level_t *lv, int16_t raw_cm);
+
+// 16-char LCD label for a state, in flash (lcd_fb_set_row_P)
+const char *level_label_P(uint8_t state);
+
+// Name of a state for uploads and the status page ("EVACUATE"), in flash
+const char *level_name_P(uint8_t state);
+
+#endif
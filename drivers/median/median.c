@@ -0,0 +1,65 @@
+#include "median.h"
+
+void median_init(median_t *m) {
+    m->idx = 0;
+    m->count = 0;
+    m->last = -1;
+}
+
+// Position of v in sorted[0..n) (any one if repeated)
+static uint8_t find_sorted(const int16_t *a, uint8_t n, int16_t v) {
+    uint8_t lo = 0;
+    uint8_t hi = n;
+    while (lo < hi) {
+        uint8_t mid = (uint8_t)((lo + hi) >> 1);
+        if (a[mid] < v) lo = (uint8_t)(mid + 1);
+        else hi = mid;
+    }
+    return lo;
+}
+
+int16_t median_push(median_t *m, int16_t v) {
+    int16_t *s = m->sorted;
+    uint8_t p;
+
+    if (m->count < MEDIAN_N) {
+        // Growing: open a hole at the end and walk it down to v's place
+        p = m->count++;
+        while (p > 0 && s[p - 1] > v) {
+            s[p] = s[p - 1];
+            p--;
+        }
+    } else {
+        // Full: reuse the evicted value's slot and walk it toward v
+        p = find_sorted(s, m->count, m->ring[m->idx]);
+        if (v > s[p]) {
+            while (p + 1 < m->count && s[p + 1] < v) {
+                s[p] = s[p + 1];
+                p++;
+            }
+        } else {
+            while (p > 0 && s[p - 1] > v) {
+                s[p] = s[p - 1];
+                p--;
+            }
+        }
+    }
+    s[p] = v;
+
+    m->ring[m->idx] = v;
+    if (++m->idx >= MEDIAN_N) m->idx = 0;
+
+    m->last = s[m->count / 2];
+    return m->last;
+}
+
+int16_t median_get(const median_t *m) {
+    return m->last;
+}
+
+int16_t median_percentile(const median_t *m, uint8_t pct) {
+    if (m->count == 0) return -1;
+    if (pct > 100) pct = 100;
+    uint16_t i = (uint16_t)(((uint16_t)(m->count - 1) * pct + 50) / 100);
+    return m->sorted[i];
+}
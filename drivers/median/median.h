@@ -0,0 +1,44 @@
+#ifndef MEDIAN_H
+#define MEDIAN_H
+
+#include <stdint.h>
+
+// Sliding-window median / percentile filter.
+// Keeps the window twice: in arrival order (ring) and sorted. A new sample
+// evicts the oldest one and the sorted copy is fixed up by shifting only the
+// entries between the two positions, so a push is O(N) with no copy or sort.
+
+// Window size, compile time (e.g. -DMEDIAN_N=31 for turbulent sites). A
+// step in the level shows in the median after (N + 1) / 2 samples, so the
+// default stays small: 5 samples, against 16 at 31, which deep in SAFE
+// (PING_SLOW_MS) is the difference between 2.5 s and 8 s. Each sample
+// also costs 4 bytes of SRAM per filter.
+#ifndef MEDIAN_N
+#define MEDIAN_N 9
+#endif
+
+#if MEDIAN_N < 1 || MEDIAN_N > 255
+#error "MEDIAN_N must be 1..255"
+#endif
+
+typedef struct {
+    int16_t ring[MEDIAN_N];    // arrival order
+    int16_t sorted[MEDIAN_N];  // same values, ascending
+    uint8_t idx;               // next ring slot to overwrite
+    uint8_t count;             // samples in the window
+    int16_t last;              // cached median, -1 while empty
+} median_t;
+
+void median_init(median_t *m);
+
+// Add a sample (evicting the oldest once full). Returns the new median.
+int16_t median_push(median_t *m, int16_t v);
+
+// Last median without touching the window, -1 if empty
+int16_t median_get(const median_t *m);
+
+// Any percentile 0..100, -1 if empty: the sorted window at index
+// round((count - 1) * pct / 100), so 0 is the minimum and 100 the maximum
+int16_t median_percentile(const median_t *m, uint8_t pct);
+
+#endif
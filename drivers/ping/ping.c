@@ -0,0 +1,48 @@
+#include "ping.h"
+#include "level.h"
+
+void ping_init(ping_t *p) {
+    p->ref_cm = -1;
+    p->ref_ms = 0;
+    p->fast_ms = 0;
+    p->fast = 0;
+}
+
+// Track |d level| / dt over windows of at least PING_RATE_MS
+static void ping_rate(ping_t *p, int16_t cm, uint32_t now) {
+    if (p->ref_cm < 0) {
+        p->ref_cm = cm;
+        p->ref_ms = now;
+        return;
+    }
+
+    uint32_t dt = now - p->ref_ms;
+    if (dt < PING_RATE_MS) return;
+
+    uint16_t d = (uint16_t)((cm > p->ref_cm) ? cm - p->ref_cm : p->ref_cm - cm);
+    if ((uint32_t)d * 1000UL >= (uint32_t)PING_FAST_CM_S * dt) {
+        p->fast = 1;
+        p->fast_ms = now;
+    }
+    p->ref_cm = cm;
+    p->ref_ms = now;
+}
+
+uint16_t ping_next(ping_t *p, int16_t raw_cm, int16_t stable_cm, uint8_t state, uint32_t now) {
+    if (stable_cm < 0) return PING_FULL_RATE;
+
+    ping_rate(p, stable_cm, now);
+    if (p->fast && now - p->fast_ms >= PING_HOLD_MS) p->fast = 0;
+
+    if (p->fast || state != STATE_SAFE) return PING_FULL_RATE;
+
+    // Closest of the filtered level and a plausible raw reading
+    int16_t cm = stable_cm;
+    if (level_valid(raw_cm) && raw_cm < cm) cm = raw_cm;
+
+    int16_t above = (int16_t)(cm - (LEVEL_PREPARE_MAX_CM + PING_NEAR_CM));
+    if (above <= 0) return PING_FULL_RATE;
+
+    uint32_t ms = (uint32_t)above * PING_MS_PER_CM;
+    return (ms > PING_SLOW_MS) ? PING_SLOW_MS : (uint16_t)ms;
+}
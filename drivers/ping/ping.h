@@ -0,0 +1,55 @@
+#ifndef PING_H
+#define PING_H
+
+#include <stdint.h>
+
+// Adaptive ping cadence. Pure logic, no hardware access.
+// After each batch of echoes ping_next() gives the period of a ping round
+// for sensor_set_period(). The sensor never pings before the previous echo
+// plus its ringdown guard (SENSOR_GUARD_MS) is over, so PING_FULL_RATE just
+// means "right after the guard". That rate applies near the PREPARE
+// threshold, while the level is unknown or changing fast, and once
+// PREPARE/EVAC is confirmed. The further the level is inside SAFE, the
+// longer the period, up to PING_SLOW_MS.
+
+#define PING_FULL_RATE  0
+
+// Slowest cadence, deep in SAFE
+#ifndef PING_SLOW_MS
+#define PING_SLOW_MS    500
+#endif
+
+// Full rate within this distance above the PREPARE threshold (cm)
+#ifndef PING_NEAR_CM
+#define PING_NEAR_CM    15
+#endif
+
+// Above the near band the period grows by this much per cm
+#define PING_MS_PER_CM  10
+
+// A level moving at least this fast (cm/s) gets the full rate, and keeps it
+// for PING_HOLD_MS after it settles
+#ifndef PING_FAST_CM_S
+#define PING_FAST_CM_S  2
+#endif
+#define PING_HOLD_MS    10000UL
+
+// The rate is measured over at least this long
+#define PING_RATE_MS    1000
+
+typedef struct {
+    int16_t ref_cm;         // filtered level at ref_ms, -1 = none yet
+    uint32_t ref_ms;
+    uint32_t fast_ms;       // last time the level moved fast
+    uint8_t fast;           // fast_ms is valid
+} ping_t;
+
+void ping_init(ping_t *p);
+
+// Period in ms, given the latest raw reading, the filtered level (-1 = none
+// yet) and the confirmed state (level.h). A single raw reading inside the
+// near band already speeds up sampling, so the median filter fills before
+// it would show the change.
+uint16_t ping_next(ping_t *p, int16_t raw_cm, int16_t stable_cm, uint8_t state, uint32_t now);
+
+#endif
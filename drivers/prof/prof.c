@@ -0,0 +1,96 @@
+#include "prof.h"
+
+#ifdef PROF_REPORT
+#include "uart.h"
+#include <avr/interrupt.h>
+#include "fmt.h"
+#include <avr/pgmspace.h>
+
+typedef struct {
+    uint16_t n;
+    uint32_t min;
+    uint32_t max;
+    uint32_t sum;
+} prof_sec_t;
+
+static prof_sec_t secs[PROF_N_SECTIONS];
+static volatile uint16_t isr_max[PROF_N_ISRS];
+
+static const char sec_esp[] PROGMEM    = "esp";
+static const char sec_sample[] PROGMEM = "sample";
+static const char sec_lcd[] PROGMEM    = "lcd";
+static const char sec_io[] PROGMEM     = "io";
+static const char sec_log[] PROGMEM    = "log";
+
+static const char *const sec_names[PROF_N_SECTIONS] PROGMEM = {
+    sec_esp, sec_sample, sec_lcd, sec_io, sec_log
+};
+
+static const char isr_sensor[] PROGMEM  = "isr sensor";
+static const char isr_uart_rx[] PROGMEM = "isr uart rx";
+static const char isr_uart_tx[] PROGMEM = "isr uart tx";
+static const char isr_twi[] PROGMEM     = "isr twi";
+static const char isr_buzzer[] PROGMEM  = "isr buzzer";
+
+static const char *const isr_names[PROF_N_ISRS] PROGMEM = {
+    isr_sensor, isr_uart_rx, isr_uart_tx, isr_twi, isr_buzzer
+};
+
+void prof_section(uint8_t sec, uint32_t cyc) {
+    prof_sec_t *s = &secs[sec];
+    if (!s->n || cyc < s->min) s->min = cyc;
+    if (cyc > s->max) s->max = cyc;
+    s->sum += cyc;
+    s->n++;
+}
+
+// Called with interrupts masked (ISRs do not nest here)
+void prof_isr(uint8_t isr, uint32_t cyc) {
+    uint16_t c = (cyc > 0xFFFF) ? 0xFFFF : (uint16_t)cyc;
+    if (c > isr_max[isr]) isr_max[isr] = c;
+}
+
+void prof_dump(void) {
+    char line[80];
+    fmt_t f;
+
+    for (uint8_t i = 0; i < PROF_N_SECTIONS; i++) {
+        prof_sec_t *s = &secs[i];
+        if (!s->n) continue;
+        fmt_init(&f, line, sizeof(line));
+        fmt_P(&f, PSTR("prof "));
+        fmt_P(&f, (const char *)pgm_read_ptr(&sec_names[i]));
+        fmt_P(&f, PSTR(": n "));
+        fmt_u(&f, s->n);
+        fmt_P(&f, PSTR(" min "));
+        fmt_u(&f, s->min);
+        fmt_P(&f, PSTR(" avg "));
+        fmt_u(&f, s->sum / s->n);
+        fmt_P(&f, PSTR(" max "));
+        fmt_u(&f, s->max);
+        fmt_P(&f, PSTR(" cyc\r\n"));
+        uart_puts(line);
+        s->n = 0;
+        s->max = 0;
+        s->sum = 0;
+    }
+
+    for (uint8_t i = 0; i < PROF_N_ISRS; i++) {
+        uint8_t sreg = SREG;
+        cli();
+        uint16_t c = isr_max[i];
+        isr_max[i] = 0;
+        SREG = sreg;
+        if (!c) continue;
+
+        fmt_init(&f, line, sizeof(line));
+        fmt_P(&f, PSTR("prof "));
+        fmt_P(&f, (const char *)pgm_read_ptr(&isr_names[i]));
+        fmt_P(&f, PSTR(": max "));
+        fmt_u(&f, c);
+        fmt_P(&f, PSTR(" cyc\r\n"));
+        uart_puts(line);
+    }
+}
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef PROF_H
+#define PROF_H
+
+#include <stdint.h>
+#include "timebase.h"
+
+// Execution-time profiler, built in with PROF_REPORT (make prof-report).
+// Sections record min / avg / max CPU cycles per run; ISRs record their
+// worst case. Times come from cycles() (timebase.h), so they are exact to
+// 64 cycles and include the ~50 cycles of the two readings themselves; an
+// ISR's time excludes its register save and restore. Without PROF_REPORT
+// the macros compile to nothing.
+//
+// One PROF_BEGIN / PROF_END pair per block (they share a local).
+
+// Sections (main code)
+#define PROF_ESP        0   // esp_task
+#define PROF_SAMPLE     1   // median filter + level decision
+#define PROF_LCD        2   // LCD frame build + flush
+#define PROF_IO         3   // twi_task + store_task
+#define PROF_LOG        4   // interval close + store_push
+#define PROF_N_SECTIONS 5
+
+// ISRs
+#define PROF_ISR_SENSOR   0   // TIMER1_COMPA / COMPB, PCINT0
+#define PROF_ISR_UART_RX  1
+#define PROF_ISR_UART_TX  2   // USART_UDRE
+#define PROF_ISR_TWI      3
+#define PROF_ISR_BUZZER   4   // TIMER0_COMPB
+#define PROF_N_ISRS       5
+
+#ifdef PROF_REPORT
+#define PROF_BEGIN()        uint32_t prof_t0_ = cycles()
+#define PROF_END(sec)       prof_section((sec), cycles() - prof_t0_)
+#define PROF_ISR_END(isr)   prof_isr((isr), cycles() - prof_t0_)
+#else
+#define PROF_BEGIN()
+#define PROF_END(sec)
+#define PROF_ISR_END(isr)
+#endif
+
+void prof_section(uint8_t sec, uint32_t cyc);
+void prof_isr(uint8_t isr, uint32_t cyc);
+
+// Write one line per section and ISR to the UART, then start a new window.
+// Counts reset with every dump, so a window must stay under ~268 s of
+// section time (the cycles() range).
+void prof_dump(void);
+
+#endif
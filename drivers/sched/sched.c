@@ -0,0 +1,102 @@
+#include "sched.h"
+#include "timebase.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+typedef struct {
+    sched_fn_t fn;
+    uint16_t period;
+    uint8_t events;
+    uint32_t due;
+    sched_stats_t stats;
+} task_t;
+
+static task_t tasks[SCHED_MAX_TASKS];
+static uint8_t n_tasks = 0;
+static volatile uint8_t pending = 0;
+
+uint8_t sched_add(sched_fn_t fn, uint16_t period_ms, uint8_t events) {
+    if (n_tasks >= SCHED_MAX_TASKS) return 0xFF;
+
+    task_t *t = &tasks[n_tasks];
+    t->fn = fn;
+    t->period = period_ms;
+    t->events = events;
+    t->due = millis();
+    t->stats.runs = 0;
+    t->stats.overruns = 0;
+    t->stats.max_late_ms = 0;
+    return n_tasks++;
+}
+
+void sched_post(uint8_t events) {
+    uint8_t s = SREG;
+    cli();
+    pending |= events;
+    SREG = s;
+}
+
+// Periodic deadline reached? Advances it by whole periods.
+static uint8_t timer_due(task_t *t, uint32_t now) {
+    if (!t->period || (int32_t)(now - t->due) < 0) return 0;
+
+    uint32_t late = now - t->due;
+    if (late > t->stats.max_late_ms) t->stats.max_late_ms = (late > 0xFFFF) ? 0xFFFF : (uint16_t)late;
+
+    if (late >= t->period) {
+        // Slots were missed: count them and realign instead of bursting
+        t->stats.overruns += (uint16_t)(late / t->period);
+        t->due = now + t->period;
+    } else {
+        t->due += t->period;
+    }
+    return 1;
+}
+
+uint8_t sched_step(void) {
+    uint8_t s = SREG;
+    cli();
+    uint8_t ev = pending;
+    pending = 0;
+    SREG = s;
+
+    uint32_t now = millis();
+    uint8_t ran = 0;
+
+    for (uint8_t i = 0; i < n_tasks; i++) {
+        task_t *t = &tasks[i];
+        uint8_t go = timer_due(t, now);
+        if (t->events & ev) go = 1;
+        if (!go) continue;
+
+        t->fn();
+        t->stats.runs++;
+        ran++;
+    }
+    return ran;
+}
+
+void sched_run(void) {
+    set_sleep_mode(SLEEP_MODE_IDLE);
+
+    for (;;) {
+        if (sched_step()) continue;
+
+        // Sleep unless an event slipped in since sched_step() looked. The
+        // instruction after sei() always executes, so an interrupt between
+        // the check and sleep_cpu() cannot be lost.
+        cli();
+        if (!pending) {
+            sleep_enable();
+            sei();
+            sleep_cpu();
+            sleep_disable();
+        }
+        sei();
+    }
+}
+
+void sched_get_stats(uint8_t id, sched_stats_t *out) {
+    if (id < n_tasks) *out = tasks[id].stats;
+}
@@ -0,0 +1,45 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+
+// Cooperative run-to-completion scheduler.
+// A task is ready when its period has elapsed (soft timer on the Timer0
+// millis tick) or when one of its events was posted, typically from an ISR.
+// Periodic tasks keep a fixed rate: the next deadline is the previous one
+// plus the period, not "now" plus the period, so sampling does not drift.
+// When nothing is ready the CPU sleeps in SLEEP_MODE_IDLE; every interrupt
+// (at the latest the 1 ms tick) wakes it.
+
+#ifndef SCHED_MAX_TASKS
+#define SCHED_MAX_TASKS 8
+#endif
+
+// Events (bit mask)
+#define SCHED_EV_SENSOR   (1u << 0)   // sensor.c: echo measured or timed out
+#define SCHED_EV_UART_RX  (1u << 1)   // uart.c: byte received
+
+typedef void (*sched_fn_t)(void);
+
+typedef struct {
+    uint16_t runs;
+    uint16_t overruns;      // deadlines missed by a whole period or more
+    uint16_t max_late_ms;   // worst start delay past a deadline
+} sched_stats_t;
+
+// period_ms = 0: runs on events only. Periodic tasks first run at once.
+// Returns the task id, or 0xFF if SCHED_MAX_TASKS are in use.
+uint8_t sched_add(sched_fn_t fn, uint16_t period_ms, uint8_t events);
+
+// Mark events pending; safe from ISRs and main code
+void sched_post(uint8_t events);
+
+// Run every ready task once. Returns how many ran.
+uint8_t sched_step(void);
+
+// sched_step() forever, sleeping whenever nothing was ready
+void sched_run(void) __attribute__((noreturn));
+
+void sched_get_stats(uint8_t id, sched_stats_t *out);
+
+#endif
@@ -1,121 +1,200 @@
 #include "sensor.h"
 #include "gpio.h"
+#include "sched.h"
+#include "prof.h"
 #include <avr/io.h>
 #include <avr/interrupt.h>
-#include <util/delay.h>
 
 #ifndef F_CPU
 #define F_CPU 16000000UL
 #endif
 
-// Timer1 prescaler 8 => 2MHz => 0.5us per tick
-// 30ms timeout => 60000 ticks
-#define TIMEOUT_TICKS 60000U
-
-typedef enum { S_IDLE=0, S_WAIT_RISE, S_WAIT_FALL, S_DONE, S_TIMEOUT } s_state_t;
-
-static volatile s_state_t st = S_IDLE;
-static volatile uint16_t t_rise = 0;
-static volatile uint16_t t_fall = 0;
-static volatile int16_t cm_val = -1;
-
-static inline void t1_setup_running(void) {
-    TCCR1A = 0;
-    TCCR1B = 0;
-    TCNT1  = 0;
-
-    // normal mode, prescaler /8
-    TCCR1B = (1 << CS11);
-
-    // Input Capture noise canceller ON (optional)
-    TCCR1B |= (1 << ICNC1);
+#define RING_MASK (SENSOR_RING_N - 1)
+#if (SENSOR_RING_N & RING_MASK) || SENSOR_RING_N > 256
+#error "SENSOR_RING_N must be a power of two <= 256"
+#endif
 
-    // Start on rising edge
-    TCCR1B |= (1 << ICES1);
+// Timer1 prescaler 8 => 2MHz => 0.5us per tick
+#define TICKS_PER_MS   (1000UL * SENSOR_TICKS_PER_US)
+#define TRIG_TICKS     (12 * SENSOR_TICKS_PER_US)      // >= 10 us TRIG pulse
+#define TIMEOUT_TICKS  (30UL * TICKS_PER_MS)           // 30ms for an echo
+#define GUARD_TICKS    ((uint32_t)SENSOR_GUARD_MS * TICKS_PER_MS)
+
+#define ECHO_MASK      ((uint8_t)(((1 << SENSOR_N) - 1) << ECHO_BIT(0)))
+
+typedef enum { S_GAP=0, S_TRIG, S_WAIT_RISE, S_WAIT_FALL } s_state_t;
+
+static volatile s_state_t st = S_GAP;
+static volatile uint16_t t1_hi = 0;     // Timer1 overflows: ticks 16..31
+static uint32_t due = 0;                // ISR only: next OCR1A event
+static uint8_t cur = 0;                 // sensor pinging / next to ping
+static uint32_t t_round = 0;            // trigger time of sensor 0
+static uint32_t t_trig = 0;
+static uint32_t t_rise = 0;
+static volatile uint32_t period = 50UL * TICKS_PER_MS;
+
+// SPSC ring: the ISRs write head, sensor_read() writes tail
+static volatile sensor_echo_t ring[SENSOR_RING_N];
+static volatile uint8_t head = 0;
+static volatile uint8_t tail = 0;
+
+static volatile sensor_stats_t stats;
+
+// 32-bit Timer1 time of a 16-bit reading taken with interrupts masked. An
+// overflow can be pending: a low reading then belongs after it.
+static uint32_t t1_ticks(uint16_t lo) {
+    uint16_t hi = t1_hi;
+    if ((TIFR1 & (1 << TOV1)) && lo < 0x8000) hi++;
+    return ((uint32_t)hi << 16) | lo;
+}
 
-    // Clear flags
-    TIFR1 = (1 << ICF1) | (1 << OCF1A) | (1 << TOV1);
+// OCR1A fires once per Timer1 wrap at the low half of `due`
+static void arm(uint32_t at) {
+    due = at;
+    OCR1A = (uint16_t)at;
+    TIFR1 = (1 << OCF1A);
+}
 
-    // Enable Input Capture + CompareA (timeout)
-    TIMSK1 = (1 << ICIE1) | (1 << OCIE1A);
+static void push(uint8_t status, uint16_t dt) {
+    uint8_t h = head;
+    uint8_t next = (uint8_t)((h + 1) & RING_MASK);
+    if (next == tail) {
+        stats.dropped++;
+    } else {
+        ring[h].t = t_trig;
+        ring[h].dt = dt;
+        ring[h].status = status;
+        ring[h].id = cur;
+        head = next;
+    }
+    sched_post(SCHED_EV_SENSOR);
+}
 
-    // timeout at TIMEOUT_TICKS
-    OCR1A = TIMEOUT_TICKS;
+// Measurement over at `end`: the next sensor goes once the guard has
+// passed; a new round also waits for its period
+static void finish(uint8_t status, uint16_t dt, uint32_t end) {
+    PCMSK0 &= ~ECHO_MASK;
+    push(status, dt);
+
+    uint32_t next = end + GUARD_TICKS;
+    if (++cur == SENSOR_N) {
+        cur = 0;
+        uint32_t p = t_round + period;
+        if ((int32_t)(p - next) > 0) next = p;
+    }
+    st = S_GAP;
+    arm(next);
 }
 
 void sensor_init(void) {
-    // PB0/ICP1 (D8) input
-    DDRB &= ~(1 << PB0);
-    PORTB &= ~(1 << PB0); // no pullup
-
-    st = S_IDLE;
-    cm_val = -1;
-}
+    // ECHO inputs, no pullups; TRIG outputs (sensor 0's is set by gpio_init)
+    ECHO_DDR  &= ~ECHO_MASK;
+    ECHO_PORT &= ~ECHO_MASK;
+    for (uint8_t i = 1; i < SENSOR_N; i++) {
+        TRIGX_DDR |= (1 << TRIGX_BIT(i));
+        trig_low(i);
+    }
 
-void sensor_start(void) {
-    if (st == S_WAIT_RISE || st == S_WAIT_FALL) return;
+    // Echo edges: pin change on PORTB, enabled per measurement
+    PCMSK0 &= ~ECHO_MASK;
+    PCIFR = (1 << PCIF0);
+    PCICR |= (1 << PCIE0);
 
-    cm_val = -1;
-    st = S_WAIT_RISE;
+    // Normal mode, free running, prescaler /8
+    TCCR1A = 0;
+    TCCR1B = (1 << CS11);
+    TIFR1  = (1 << OCF1A) | (1 << OCF1B) | (1 << TOV1);
 
-    // Trigger pulse (10us) — tiny delay is fine
-    trig_low();
-    _delay_us(3);
-    trig_high();
-    _delay_us(10);
-    trig_low();
+    st = S_GAP;
+    arm((uint32_t)TCNT1 + GUARD_TICKS);
+    TIMSK1 = (1 << TOIE1) | (1 << OCIE1A);
+}
 
-    t1_setup_running();
+void sensor_set_period(uint16_t ms) {
+    uint32_t p = (uint32_t)ms * TICKS_PER_MS;
+    uint8_t s = SREG;
+    cli();
+    period = p;
+    SREG = s;
 }
 
-uint8_t sensor_done(void) {
-    return (st == S_DONE || st == S_TIMEOUT);
+uint8_t sensor_read(sensor_echo_t *e) {
+    uint8_t t = tail;
+    if (t == head) return 0;
+    e->t = ring[t].t;
+    e->dt = ring[t].dt;
+    e->status = ring[t].status;
+    e->id = ring[t].id;
+    tail = (uint8_t)((t + 1) & RING_MASK);
+    return 1;
 }
 
-int16_t sensor_get_cm(void) {
-    int16_t v;
+int16_t sensor_cm(const sensor_echo_t *e) {
+    if (e->status != SENSOR_OK) return -1;
+    // cm = (dt*0.5us)/58us ≈ dt/116
+    return (int16_t)(e->dt / 116U);
+}
 
+void sensor_get_stats(sensor_stats_t *out) {
     uint8_t s = SREG;
     cli();
-    v = cm_val;
-
-    // ✅ consume the result so sensor_done() won't stay true forever
-    if (st == S_DONE || st == S_TIMEOUT) {
-        st = S_IDLE;
-    }
-
+    *out = stats;
     SREG = s;
-    return v;
 }
 
+ISR(TIMER1_OVF_vect) {
+    t1_hi++;
+}
 
-ISR(TIMER1_CAPT_vect) {
-    uint16_t cap = ICR1;
-
-    if (st == S_WAIT_RISE) {
-        t_rise = cap;
-        // switch to falling edge
-        TCCR1B &= ~(1 << ICES1);
-        st = S_WAIT_FALL;
-    } else if (st == S_WAIT_FALL) {
-        t_fall = cap;
-
-        // stop interrupts for this measurement
-        TIMSK1 = 0;
+// Trigger start (S_GAP) or echo timeout (S_WAIT_*)
+ISR(TIMER1_COMPA_vect) {
+    PROF_BEGIN();
+    uint32_t now = t1_ticks(TCNT1);
+
+    // Matches on earlier wraps are not the event yet
+    if ((int32_t)(due - now) <= 0) {
+        if (st == S_GAP) {
+            trig_high(cur);
+            OCR1B = (uint16_t)(TCNT1 + TRIG_TICKS);
+            TIFR1 = (1 << OCF1B);
+            TIMSK1 |= (1 << OCIE1B);
+            t_trig = now;
+            if (!cur) t_round = now;
+            st = S_TRIG;
+            stats.pings++;
+        } else if (st == S_WAIT_RISE || st == S_WAIT_FALL) {
+            finish(SENSOR_TIMEOUT, 0, now);
+        }
+    }
+    PROF_ISR_END(PROF_ISR_SENSOR);
+}
 
-        uint16_t dt = (uint16_t)(t_fall - t_rise); // wraps OK
-        // cm = (dt*0.5us)/58us ≈ dt/116
-        cm_val = (int16_t)(dt / 116U);
+// Trigger end: wait for the echo
+ISR(TIMER1_COMPB_vect) {
+    PROF_BEGIN();
+    trig_low(cur);
+    TIMSK1 &= ~(1 << OCIE1B);
 
-        st = S_DONE;
-    }
+    // Only the pinging sensor's ECHO
+    PCMSK0 = (uint8_t)((PCMSK0 & ~ECHO_MASK) | (1 << ECHO_BIT(cur)));
+    PCIFR = (1 << PCIF0);
+    st = S_WAIT_RISE;
+    arm(t1_ticks(TCNT1) + TIMEOUT_TICKS);
+    PROF_ISR_END(PROF_ISR_SENSOR);
 }
 
-ISR(TIMER1_COMPA_vect) {
-    // timeout
-    if (st == S_WAIT_RISE || st == S_WAIT_FALL) {
-        TIMSK1 = 0;
-        cm_val = -1;
-        st = S_TIMEOUT;
+// Echo edge: Timer1 is read first, so only the interrupt latency (a few
+// us at worst, under a mm) adds to the timestamp
+ISR(PCINT0_vect) {
+    PROF_BEGIN();
+    uint32_t now = t1_ticks(TCNT1);
+    uint8_t high = (uint8_t)(ECHO_PIN & (1 << ECHO_BIT(cur)));
+
+    if (st == S_WAIT_RISE && high) {
+        t_rise = now;
+        st = S_WAIT_FALL;
+    } else if (st == S_WAIT_FALL && !high) {
+        finish(SENSOR_OK, (uint16_t)(now - t_rise), now);
     }
+    PROF_ISR_END(PROF_ISR_SENSOR);
 }
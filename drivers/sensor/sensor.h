@@ -3,15 +3,67 @@
 
 #include <stdint.h>
 
+// HC-SR04 ranging for SENSOR_N sensors (pins in gpio.h), timed entirely
+// by Timer1 (free running, /8 = 0.5 us). The sensors ping one at a time,
+// round robin, so no sensor hears another's echo. The Timer1 ISRs raise and
+// drop TRIG on output-compare matches. A pin-change interrupt timestamps
+// both echo edges with Timer1. The ISRs schedule the next ping themselves:
+// the next sensor goes right after the previous echo plus a ringdown guard;
+// a new round starts one period after the last one began, but never before
+// that guard either. Every result goes into an SPSC ring that the main
+// code drains in batches, so a busy loop delays samples but loses none
+// (unless it stalls for a whole ring's worth of pings; see dropped).
+// Fusing the sensors' readings is vote.h's job.
+
+// Sensors on the station, 1..4
+#ifndef SENSOR_N
+#define SENSOR_N 1
+#endif
+
+#if SENSOR_N < 1 || SENSOR_N > 4
+#error "SENSOR_N must be 1..4"
+#endif
+
+// Quiet time after an echo (or timeout) before the next trigger
+#ifndef SENSOR_GUARD_MS
+#define SENSOR_GUARD_MS 20
+#endif
+
+// Results held between drains: power of two, max 256
+#ifndef SENSOR_RING_N
+#define SENSOR_RING_N 8
+#endif
+
+#define SENSOR_TICKS_PER_US 2
+
+// Result status
+#define SENSOR_OK       0
+#define SENSOR_TIMEOUT  1   // no echo, or no falling edge, within 30 ms
+
+typedef struct {
+    uint32_t t;         // trigger time, Timer1 ticks (wraps after ~36 min)
+    uint16_t dt;        // echo width, Timer1 ticks (SENSOR_OK only)
+    uint8_t status;
+    uint8_t id;         // sensor, 0..SENSOR_N-1
+} sensor_echo_t;
+
+typedef struct {
+    uint16_t pings;
+    uint16_t dropped;   // results lost to a full ring
+} sensor_stats_t;
+
+// Starts Timer1 and the first ping
 void sensor_init(void);
 
-// Start a measurement (nonblocking)
-void sensor_start(void);
+// Period of a round (all SENSOR_N pings), from the next round on
+void sensor_set_period(uint16_t ms);
+
+// Oldest unread result; 0 if the ring is empty
+uint8_t sensor_read(sensor_echo_t *e);
 
-// Check if measurement is done
-uint8_t sensor_done(void);
+// Distance of a result in cm, -1 for a timeout
+int16_t sensor_cm(const sensor_echo_t *e);
 
-// Get result (valid only if done). returns -1 if timeout
-int16_t sensor_get_cm(void);
+void sensor_get_stats(sensor_stats_t *out);
 
 #endif
@@ -0,0 +1,64 @@
+#include "vote.h"
+#include "level.h"
+
+void vote_init(vote_t *v) {
+    for (uint8_t i = 0; i < SENSOR_N; i++) {
+        v->cm[i] = -1;
+        v->health[i] = VOTE_HEALTH_MAX;
+    }
+}
+
+static void vote_score(vote_t *v, uint8_t i, uint8_t good) {
+    uint8_t h = v->health[i];
+    if (good) h = (h > VOTE_HEALTH_MAX - VOTE_REWARD) ? VOTE_HEALTH_MAX : (uint8_t)(h + VOTE_REWARD);
+    else h = (h < VOTE_PENALTY) ? 0 : (uint8_t)(h - VOTE_PENALTY);
+    v->health[i] = h;
+}
+
+static int16_t vote_round(vote_t *v) {
+    int16_t sorted[SENSOR_N];
+    uint8_t n = 0, healthy = 0;
+
+    // Nobody healthy: everyone votes, or nobody could ever recover
+    uint8_t any = 0;
+    for (uint8_t i = 0; i < SENSOR_N; i++) if (v->health[i] >= VOTE_HEALTHY) any = 1;
+
+    for (uint8_t i = 0; i < SENSOR_N; i++) {
+        if (any && v->health[i] < VOTE_HEALTHY) continue;
+        healthy++;
+        if (v->cm[i] < 0) continue;
+
+        // Insertion sort, ascending
+        uint8_t k = n++;
+        while (k && sorted[k - 1] > v->cm[i]) {
+            sorted[k] = sorted[k - 1];
+            k--;
+        }
+        sorted[k] = v->cm[i];
+    }
+
+    if (!n) return -1;
+    if (any && healthy > 1 && 2 * n <= healthy) return -1;
+    return sorted[(n - 1) / 2];
+}
+
+uint8_t vote_add(vote_t *v, uint8_t id, int16_t cm, int16_t *fused) {
+    if (id >= SENSOR_N) return 0;
+    v->cm[id] = level_valid(cm) ? cm : -1;
+    if (id != SENSOR_N - 1) return 0;
+
+    int16_t f = vote_round(v);
+    for (uint8_t i = 0; i < SENSOR_N; i++) {
+        int16_t c = v->cm[i];
+        v->cm[i] = -1;
+        // Without a fused value a reading proves nothing either way
+        if (c >= 0 && f < 0) continue;
+        vote_score(v, i, c >= 0 && (c > f ? c - f : f - c) <= VOTE_TOL_CM);
+    }
+    *fused = f;
+    return 1;
+}
+
+uint8_t vote_health(const vote_t *v, uint8_t id) {
+    return (id < SENSOR_N) ? v->health[id] : 0;
+}
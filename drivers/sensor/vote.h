@@ -0,0 +1,47 @@
+#ifndef VOTE_H
+#define VOTE_H
+
+#include <stdint.h>
+#include "sensor.h"
+
+// Fuses one round of SENSOR_N readings into a single distance. Pure logic.
+//
+// Each sensor has a health score. Timeouts, out-of-range readings and
+// readings more than VOTE_TOL_CM away from the fused value cost
+// VOTE_PENALTY; agreeing readings earn VOTE_REWARD back. Sensors below
+// VOTE_HEALTHY are left out of the vote but keep pinging, so they rejoin
+// once they agree again.
+//
+// The fused value is the lower median of the healthy sensors' valid
+// readings: with an even count the smaller distance (higher water) wins.
+// A transducer that fails with far readings is therefore outvoted by
+// two or more healthy ones and, with only two, loses to the nearer one;
+// one that fails silent just drops out. A round where no more than half of
+// the healthy sensors answered gives no reading (-1) rather than trusting
+// the minority, so a lone far reading never stands in for the others.
+// Only when no sensor is healthy does every valid reading vote again, so
+// the station can recover.
+
+#define VOTE_HEALTH_MAX  100
+#define VOTE_HEALTHY     50
+#define VOTE_PENALTY     25
+#define VOTE_REWARD      5
+
+#ifndef VOTE_TOL_CM
+#define VOTE_TOL_CM      10
+#endif
+
+typedef struct {
+    int16_t cm[SENSOR_N];       // this round, -1 = nothing valid
+    uint8_t health[SENSOR_N];
+} vote_t;
+
+void vote_init(vote_t *v);
+
+// Feed one result (sensor_cm()). When it completes a round returns 1 and
+// sets *fused (-1 = no usable reading this round).
+uint8_t vote_add(vote_t *v, uint8_t id, int16_t cm, int16_t *fused);
+
+uint8_t vote_health(const vote_t *v, uint8_t id);
+
+#endif
@@ -0,0 +1,43 @@
+#include "sram.h"
+#include <avr/io.h>
+
+#define SRAM_CANARY 0xC5
+
+// From the linker: end of .bss, and the initial stack pointer (RAMEND)
+extern uint8_t _end;
+extern uint8_t __stack;
+
+// Runs from .init1, before the stack pointer and r1 are set up, so no C:
+// fill [_end, __stack] with the canary
+void sram_paint(void) __attribute__((naked, used, section(".init1")));
+
+void sram_paint(void) {
+    __asm__ volatile (
+        "    ldi r30, lo8(_end)\n"
+        "    ldi r31, hi8(_end)\n"
+        "    ldi r24, %0\n"
+        "    ldi r25, hi8(__stack)\n"
+        "    rjmp 2f\n"
+        "1:  st Z+, r24\n"
+        "2:  cpi r30, lo8(__stack)\n"
+        "    cpc r31, r25\n"
+        "    brlo 1b\n"
+        "    breq 1b\n"
+        :: "i" (SRAM_CANARY));
+}
+
+uint16_t sram_free(void) {
+    uint8_t here;
+    return (uint16_t)(&here - &_end);
+}
+
+uint16_t sram_stack_unused(void) {
+    const uint8_t *p = &_end;
+    uint16_t n = 0;
+
+    while (p <= &__stack && *p == SRAM_CANARY) {
+        p++;
+        n++;
+    }
+    return n;
+}
@@ -0,0 +1,18 @@
+#ifndef SRAM_H
+#define SRAM_H
+
+#include <stdint.h>
+
+// Free SRAM between the end of static data (.data + .bss; there is no heap)
+// and the stack. Before any C code runs the gap is painted with a canary
+// byte; whatever of it the stack has never overwritten since is the margin
+// left at its deepest point so far (the high-water mark).
+
+// Bytes between the end of static data and the current stack pointer
+uint16_t sram_free(void);
+
+// Bytes of the gap the stack has never touched since reset. Scans the gap:
+// call now and then, not every pass.
+uint16_t sram_stack_unused(void);
+
+#endif
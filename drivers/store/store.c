@@ -0,0 +1,370 @@
+#include "store.h"
+#include <avr/io.h>
+#include <avr/eeprom.h>
+
+// EEPROM layout:
+//   0           boot counter
+//   EE_RING..   slots: [seq lo][seq hi][ts x4][f x2 each], little endian
+// seq is 15 bits; bit 15 set (hi byte 0xFF after erase) marks a free slot.
+#define EE_BOOT     ((uint8_t *)0)
+#define EE_RING     16
+#define DATA_SZ     (4 + 2 * READING_FIELDS)
+#define SLOT_SZ     (2 + DATA_SZ)
+#define EE_SLOTS    ((uint16_t)((E2END + 1 - EE_RING) / SLOT_SZ))
+
+#define SEQ_MASK    0x7FFF
+#define SEQ_FREE    0x8000
+
+static uint16_t ee_tail = 0;    // oldest queued slot
+static uint16_t ee_count = 0;
+static uint16_t next_seq = 0;
+
+static reading_t ram[STORE_RAM_N];
+static uint8_t ram_tail = 0;
+static uint8_t ram_count = 0;
+
+// Alerts: parked, then at the head of the queue
+static reading_t park;
+static reading_t head;
+static uint8_t park_on = 0;
+static uint8_t head_on = 0;
+
+// Superseded alerts, oldest first. The first late_vis follow the head; the
+// rest were superseded while parked and wait for store_promote().
+static reading_t late[STORE_LATE_N];
+static uint8_t late_n = 0;
+static uint8_t late_vis = 0;
+
+// Spill in progress: spill_r -> slot at ee_tail + ee_count. The reading
+// left the SRAM FIFO when the spill started and sits between the two.
+// Steps: 0 = free the slot, 1..DATA_SZ = data, then seq lo, seq hi.
+static reading_t spill_r;
+static uint8_t spill_on = 0;
+static uint8_t spill_step = 0;
+static uint16_t spill_seq = 0;
+
+// Popped slots still to be marked free, starting at inval_at
+static uint16_t inval_at = 0;
+static uint16_t inval_n = 0;
+
+// Oldest readings a request in flight carries (store_hold)
+static uint8_t held = 0;
+
+static store_stats_t stats;
+
+static uint8_t *slot_addr(uint16_t slot) {
+    return (uint8_t *)(uintptr_t)(EE_RING + slot * SLOT_SZ);
+}
+
+static uint16_t slot_next(uint16_t slot) {
+    return (slot + 1 < EE_SLOTS) ? slot + 1 : 0;
+}
+
+static uint16_t slot_add(uint16_t slot, uint16_t n) {
+    return (uint16_t)((slot + n) % EE_SLOTS);
+}
+
+static uint16_t slot_seq(uint16_t slot) {
+    uint8_t *a = slot_addr(slot);
+    return (uint16_t)(eeprom_read_byte(a) | ((uint16_t)eeprom_read_byte(a + 1) << 8));
+}
+
+#define STEP_SEQ_LO (DATA_SZ + 1)
+#define STEP_SEQ_HI (DATA_SZ + 2)
+
+static uint8_t spill_byte(uint8_t step) {
+    const reading_t *r = &spill_r;
+    if (step == 0) return 0xFF;     // hi byte of seq: slot free while rewritten
+    if (step == STEP_SEQ_LO) return (uint8_t)spill_seq;
+    if (step == STEP_SEQ_HI) return (uint8_t)(spill_seq >> 8);
+
+    uint8_t d = (uint8_t)(step - 1);
+    if (d < 4) return (uint8_t)(r->ts >> (8 * d));
+    d -= 4;
+    return (uint8_t)((uint16_t)r->f[d >> 1] >> (8 * (d & 1)));
+}
+
+static uint8_t spill_offset(uint8_t step) {
+    // step 0 and the last both target the seq hi byte
+    if (step == 0 || step == STEP_SEQ_HI) return 1;
+    if (step == STEP_SEQ_LO) return 0;
+    return (uint8_t)(step + 1);
+}
+
+// Finished writing: the reading now lives in EEPROM
+static void spill_done(void) {
+    ee_count++;
+    next_seq = (uint16_t)((spill_seq + 1) & SEQ_MASK);
+    stats.spilled++;
+    spill_on = 0;
+}
+
+// One EEPROM byte if the EEPROM is idle. Returns 1 if a write was issued.
+static uint8_t ee_step(void) {
+    if (!eeprom_is_ready()) return 0;
+
+    if (spill_on) {
+        uint16_t slot = slot_add(ee_tail, ee_count);
+        eeprom_write_byte(slot_addr(slot) + spill_offset(spill_step), spill_byte(spill_step));
+        if (++spill_step > STEP_SEQ_HI) spill_done();
+        return 1;
+    }
+
+    if (inval_n) {
+        eeprom_write_byte(slot_addr(inval_at) + 1, 0xFF);
+        inval_at = slot_next(inval_at);
+        inval_n--;
+        return 1;
+    }
+    return 0;
+}
+
+
+// Move the oldest SRAM reading out, into spill_r
+static void spill_start(void) {
+    spill_r = ram[ram_tail];
+    if (++ram_tail >= STORE_RAM_N) ram_tail = 0;
+    ram_count--;
+
+    if (ee_count == EE_SLOTS) {
+        // Ring full: the slot about to be written holds the oldest reading
+        ee_tail = slot_next(ee_tail);
+        ee_count--;
+        stats.overwritten++;
+    }
+    spill_on = 1;
+    spill_step = 0;
+    spill_seq = next_seq;
+
+    // Target wrapped onto a popped slot still waiting to be freed: the
+    // spill frees it itself, and a later free would erase the new reading
+    if (inval_n && slot_add(ee_tail, ee_count) == inval_at) {
+        inval_at = slot_next(inval_at);
+        inval_n--;
+    }
+}
+
+// Spill ahead of the next push, unless that would overwrite the oldest
+// EEPROM reading before it has to go
+static void spill_ahead(void) {
+    if (ram_count == STORE_RAM_N && !spill_on && ee_count < EE_SLOTS) spill_start();
+}
+
+void store_task(void) {
+    (void)ee_step();
+    spill_ahead();
+}
+
+uint8_t store_init(void) {
+    uint8_t boot = (uint8_t)(eeprom_read_byte(EE_BOOT) + 1);
+    eeprom_update_byte(EE_BOOT, boot);
+
+    // Newest slot = highest sequence number (all live ones are within
+    // EE_SLOTS of each other, so compare relative to any one of them).
+    uint16_t newest = 0xFFFF;
+    uint16_t ref = 0;
+    int16_t best = 0;
+
+    for (uint16_t i = 0; i < EE_SLOTS; i++) {
+        uint16_t seq = slot_seq(i);
+        if (seq & SEQ_FREE) continue;
+        if (newest == 0xFFFF) {
+            ref = seq;
+            newest = i;
+            best = 0;
+            continue;
+        }
+        uint16_t u = (uint16_t)((seq - ref) & SEQ_MASK);
+        int16_t d = (u & 0x4000) ? (int16_t)(u - 0x8000) : (int16_t)u;
+        if (d > best) {
+            best = d;
+            newest = i;
+        }
+    }
+
+    ee_count = 0;
+    if (newest == 0xFFFF) {
+        ee_tail = 0;
+        next_seq = 0;
+    } else {
+        // Walk back over consecutive sequence numbers
+        uint16_t seq = slot_seq(newest);
+        uint16_t s = newest;
+        ee_count = 1;
+        while (ee_count < EE_SLOTS) {
+            uint16_t prev = s ? s - 1 : EE_SLOTS - 1;
+            uint16_t ps = slot_seq(prev);
+            if ((ps & SEQ_FREE) || (uint16_t)((ps + 1) & SEQ_MASK) != seq) break;
+            s = prev;
+            seq = ps;
+            ee_count++;
+        }
+        ee_tail = s;
+        next_seq = (uint16_t)((slot_seq(newest) + 1) & SEQ_MASK);
+    }
+
+    ram_tail = 0;
+    ram_count = 0;
+    park_on = 0;
+    head_on = 0;
+    late_n = 0;
+    late_vis = 0;
+    spill_on = 0;
+    inval_n = 0;
+    held = 0;
+    stats.ee_slots = EE_SLOTS;
+    return boot & 0x7F;
+}
+
+// The oldest EEPROM or SRAM reading is part of the request in flight
+static uint8_t ee_held(void) {
+    return ee_count && held > head_on + late_vis;
+}
+
+static uint8_t ram_held(void) {
+    return held > head_on + late_vis + ee_count + spill_on;
+}
+
+void store_push(const reading_t *r) {
+    if (ram_count == STORE_RAM_N) {
+        // Make room: move the oldest towards EEPROM. With a spill already
+        // under way (readings faster than one per ~SLOT_SZ EEPROM writes)
+        // there is nowhere to put it, and it is dropped instead. Neither
+        // may take a reading a request is carrying.
+        if (!spill_on && !(ee_count == EE_SLOTS && ee_held())) {
+            spill_start();
+        } else if (ram_held()) {
+            stats.held++;
+            return;
+        } else {
+            if (++ram_tail >= STORE_RAM_N) ram_tail = 0;
+            ram_count--;
+            if (spill_on) stats.dropped++;
+            else stats.held++;
+        }
+    }
+
+    uint8_t h = (uint8_t)((ram_tail + ram_count) % STORE_RAM_N);
+    ram[h] = *r;
+    ram_count++;
+    spill_ahead();
+}
+
+// Superseded alert: a routine reading at late[at]. Only entries not yet
+// seen by peek move, so a request in flight is not disturbed.
+static void demote(reading_t *r, uint8_t at) {
+    r->status = READING_ROUTINE;
+    if (late_n == STORE_LATE_N) {
+        store_push(r);
+        stats.late_last++;
+        return;
+    }
+    for (uint8_t i = late_n; i > at; i--) late[i] = late[i - 1];
+    late[at] = *r;
+    late_n++;
+}
+
+void store_push_alert(const reading_t *r) {
+    if (park_on) demote(&park, late_n);
+    park = *r;
+    park_on = 1;
+}
+
+void store_promote(void) {
+    if (!park_on) return;
+    // The old head is older than any alert superseded since it took over
+    if (head_on) demote(&head, late_vis);
+    head = park;
+    head_on = 1;
+    park_on = 0;
+    late_vis = late_n;
+}
+
+uint8_t store_alert_pending(void) {
+    return park_on || head_on;
+}
+
+uint16_t store_count(void) {
+    return (uint16_t)(park_on + head_on + late_n + ee_count + spill_on + ram_count);
+}
+
+uint32_t store_log_interval(uint32_t base_ms) {
+    uint16_t k = store_count() / STORE_COARSEN_N;
+    if (k > STORE_COARSEN_MAX) k = STORE_COARSEN_MAX;
+    return base_ms << k;
+}
+
+uint8_t store_peek(uint16_t i, reading_t *r) {
+    if (head_on) {
+        if (i == 0) {
+            *r = head;
+            return 1;
+        }
+        i--;
+    }
+    if (i < late_vis) {
+        *r = late[i];
+        return 1;
+    }
+    i -= late_vis;
+    if (i < ee_count) {
+        uint8_t b[SLOT_SZ];
+        eeprom_read_block(b, slot_addr(slot_add(ee_tail, i)), SLOT_SZ);
+        r->ts = (uint32_t)b[2] | ((uint32_t)b[3] << 8) | ((uint32_t)b[4] << 16) | ((uint32_t)b[5] << 24);
+        for (uint8_t k = 0; k < READING_FIELDS; k++) {
+            r->f[k] = (int16_t)(b[6 + 2 * k] | ((uint16_t)b[7 + 2 * k] << 8));
+        }
+        r->status = READING_ROUTINE;
+        return 1;
+    }
+    i -= ee_count;
+    if (spill_on) {
+        if (i == 0) {
+            *r = spill_r;
+            return 1;
+        }
+        i--;
+    }
+    if (i >= ram_count) return 0;
+    *r = ram[(uint8_t)((ram_tail + i) % STORE_RAM_N)];
+    return 1;
+}
+
+void store_hold(uint8_t n) {
+    held = n;
+}
+
+void store_pop(uint16_t n) {
+    held = 0;
+    if (n && head_on) {
+        head_on = 0;
+        n--;
+    }
+    while (n && late_vis) {
+        for (uint8_t i = 1; i < late_n; i++) late[i - 1] = late[i];
+        late_n--;
+        late_vis--;
+        n--;
+    }
+    while (n && ee_count) {
+        if (!inval_n) inval_at = ee_tail;
+        inval_n++;
+        ee_tail = slot_next(ee_tail);
+        ee_count--;
+        n--;
+    }
+    if (n && spill_on) {
+        // Popped mid-spill: abandon it, its slot stays free
+        spill_on = 0;
+        n--;
+    }
+    while (n && ram_count) {
+        if (++ram_tail >= STORE_RAM_N) ram_tail = 0;
+        ram_count--;
+        n--;
+    }
+}
+
+void store_get_stats(store_stats_t *out) {
+    *out = stats;
+}
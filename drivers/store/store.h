@@ -0,0 +1,107 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include <stdint.h>
+
+// Store-and-forward queue of timestamped readings.
+// New readings go to a small SRAM FIFO. When it is full the oldest one is
+// moved to a ring of EEPROM slots. Slots are written round robin with a
+// sequence number, which spreads wear evenly and lets store_init() find the
+// queue again after a reset (the SRAM FIFO is lost). EEPROM writes are
+// issued one byte at a time from store_task(), so no call ever waits on the
+// EEPROM.
+//
+// A slot holds a whole reading (22 bytes), so the ATmega328P's 1 KB takes
+// 45, and with the SRAM FIFO 49 readings are kept. To make them last through
+// a long outage the logger stretches its interval as the queue grows
+// (store_log_interval): at main.c's intervals they cover about 9 h while
+// SAFE, 3 h in PREPARE and 2.2 h in EVACUATE. Beyond that each new reading
+// overwrites the oldest one in the ring (stats.overwritten).
+//
+// Order is oldest first: EEPROM slots, then SRAM. An alert goes ahead of
+// them all (store_push_alert).
+
+#ifndef STORE_RAM_N
+#define STORE_RAM_N 4
+#endif
+
+// The log interval doubles for every STORE_COARSEN_N readings queued, at
+// most STORE_COARSEN_MAX times
+#ifndef STORE_COARSEN_N
+#define STORE_COARSEN_N 8
+#endif
+#ifndef STORE_COARSEN_MAX
+#define STORE_COARSEN_MAX 5
+#endif
+
+// Superseded alerts kept behind the head (store_push_alert)
+#ifndef STORE_LATE_N
+#define STORE_LATE_N 2
+#endif
+
+// One upload: ThingSpeak field1..field8 (layout in agg.h)
+#define READING_FIELDS  8
+#define READING_NONE    INT16_MIN   // no value, field left out
+#define READING_ROUTINE 0xFF        // status of a periodic reading
+
+typedef struct {
+    uint32_t ts;    // clock_stamp()
+    int16_t f[READING_FIELDS];
+    uint8_t status; // alert: the state just confirmed (STATE_*); SRAM only
+} reading_t;
+
+// Scan EEPROM for queued readings. Returns this boot's id (7 bits).
+uint8_t store_init(void);
+
+// Call from the main loop: advances pending EEPROM writes
+void store_task(void);
+
+void store_push(const reading_t *r);
+
+// Alerts jump the queue. store_push_alert() parks the reading and
+// store_promote(), called by the uploader between requests, moves it to the
+// head; until then peek and pop do not see it, so a request in flight is
+// never disturbed. An alert that is superseded before it went out follows
+// the new one as a routine reading, oldest first, so no interval is lost.
+// Beyond STORE_LATE_N of them the newest is queued last instead
+// (stats.late_last). Upload order is thus not time order: a bulk request
+// sorts its rows (tsreq.h). Alerts are not kept
+// across a reset.
+void store_push_alert(const reading_t *r);
+void store_promote(void);
+
+// An alert is parked or at the head
+uint8_t store_alert_pending(void);
+
+// Queued readings, parked ones included
+uint16_t store_count(void);
+
+// Interval for the next reading given the backlog: base_ms while uploads
+// keep up, longer the more readings wait, so each one sums up more of the
+// outage instead of the ring overwriting the start of it
+uint32_t store_log_interval(uint32_t base_ms);
+
+// i-th reading in upload order; 0 past the end (parked ones are not seen)
+uint8_t store_peek(uint16_t i, reading_t *r);
+
+// A request carries the n oldest readings: until store_pop() or the next
+// store_hold() none of them moves or is lost, so peek(i) stays the same
+// reading. A push that would overwrite or drop one of them drops the oldest
+// reading outside the hold, or else the new one (stats.held).
+void store_hold(uint8_t n);
+
+// Drop the n oldest readings (after they were uploaded); ends the hold
+void store_pop(uint16_t n);
+
+typedef struct {
+    uint16_t spilled;       // readings moved SRAM -> EEPROM
+    uint16_t overwritten;   // oldest EEPROM readings lost to a full ring
+    uint16_t dropped;       // oldest SRAM readings lost to pushes during a spill
+    uint16_t late_last;     // superseded alerts queued last
+    uint16_t held;          // readings lost instead of held ones (store_hold)
+    uint16_t ee_slots;      // EEPROM ring capacity
+} store_stats_t;
+
+void store_get_stats(store_stats_t *out);
+
+#endif
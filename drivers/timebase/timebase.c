@@ -0,0 +1,56 @@
+#include "timebase.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+
+//millis using Timer0 CTC 1ms 
+#define TB_PRESCALE  64
+#define TB_COUNTS    (F_CPU / TB_PRESCALE / 1000)   // Timer0 counts per ms
+
+static volatile uint32_t g_ms = 0;
+
+ISR(TIMER0_COMPA_vect) { g_ms++; }
+
+void timebase_init(void) {
+    TCCR0A = (1 << WGM01);
+    TCCR0B = (1 << CS01) | (1 << CS00); // /64
+    OCR0A  = TB_COUNTS - 1;             // 1ms
+    TIMSK0 = (1 << OCIE0A);
+}
+
+// g_ms is written by one ISR only, at most once per ms: a read that matches
+// a second read was not torn
+uint32_t millis(void) {
+    uint32_t m;
+    do {
+        m = g_ms;
+    } while (m != g_ms);
+    return m;
+}
+
+// Tick count and TCNT0 as one consistent pair. With interrupts masked (in
+// an ISR) a tick can be pending: then TCNT0 has already wrapped and the
+// compare flag is still set, so the tick is added here.
+static uint32_t counts(void) {
+    uint32_t m;
+    uint8_t t, f;
+    do {
+        m = g_ms;
+        t = TCNT0;
+        f = TIFR0 & (1 << OCF0A);
+    } while (m != g_ms);
+
+    if (f && t < TB_COUNTS / 2) m++;
+    return m * TB_COUNTS + t;
+}
+
+uint32_t micros(void) {
+    return counts() * (1000000UL / (F_CPU / TB_PRESCALE));
+}
+
+uint32_t cycles(void) {
+    return counts() * TB_PRESCALE;
+}
@@ -0,0 +1,18 @@
+#ifndef TIMEBASE_H
+#define TIMEBASE_H
+
+#include <stdint.h>
+
+// Timer0 CTC, 1 ms tick (/64: one count = 64 cycles = 4 us at 16 MHz).
+// All readers are lock-free and safe from ISRs: none of them touches SREG.
+void timebase_init(void);
+uint32_t millis(void);
+
+// Tick count plus TCNT0: 4 us steps, wraps after ~71 minutes
+uint32_t micros(void);
+
+// CPU cycles since boot in 64-cycle steps, wraps after ~268 s at 16 MHz.
+// For timing sections: differences are exact to one Timer0 count.
+uint32_t cycles(void);
+
+#endif
@@ -1,10 +1,111 @@
 #include "twi.h"
+#include "timebase.h"
+#include "prof.h"
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
 
 #ifndef F_CPU
 #define F_CPU 16000000UL
 #endif
 
+// Ring of queued transactions: [addr][len][data...] ...
+#ifndef TWI_BUF_SZ
+#define TWI_BUF_SZ 128
+#endif
+#define Q_MASK (TWI_BUF_SZ - 1)
+
+#if (TWI_BUF_SZ & Q_MASK) || TWI_BUF_SZ > 256
+#error "TWI_BUF_SZ must be a power of two <= 256"
+#endif
+
+// One transaction of a full ring at 100 kHz takes ~12 ms
+#define TWI_TIMEOUT_MS  25
+// After a failed recovery, writes are refused and recovery retried this often
+#define TWI_RETRY_MS    1000
+
+// SCL = PC5, SDA = PC4
+#define SCL_BIT PC5
+#define SDA_BIT PC4
+
+#define TWCR_GO ((1 << TWINT) | (1 << TWEN) | (1 << TWIE))
+
+static volatile uint8_t q[TWI_BUF_SZ];
+static volatile uint8_t q_head = 0;   // written by main loop
+static volatile uint8_t q_tail = 0;   // written by TWI ISR
+
+static volatile uint8_t busy = 0;     // START..STOP sequence in progress
+static volatile uint8_t cur_left = 0; // data bytes left in current transaction
+static volatile uint32_t cur_start = 0;
+
+static volatile twi_stats_t stats;
+
+static uint8_t bus_down = 0;
+static uint32_t bus_retry_at = 0;
+
+// ISR context: STOP the current transaction and chain a START if more is queued
+static void twi_finish(void) {
+    cur_left = 0;
+    if (q_tail != q_head) {
+        cur_start = millis();
+        TWCR = TWCR_GO | (1 << TWSTO) | (1 << TWSTA);
+    } else {
+        busy = 0;
+        TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWSTO);
+    }
+}
+
+// ISR context: discard the rest of the current transaction
+static void twi_skip(void) {
+    q_tail = (uint8_t)((q_tail + cur_left) & Q_MASK);
+    cur_left = 0;
+    stats.dropped++;
+}
+
+ISR(TWI_vect) {
+    PROF_BEGIN();
+    uint8_t t = q_tail;
+
+    switch (TWSR & 0xF8) {
+    case 0x08: // START
+    case 0x10: // REPEATED START
+        TWDR = (uint8_t)(q[t] << 1);                // SLA+W
+        cur_left = q[(uint8_t)((t + 1) & Q_MASK)];
+        q_tail = (uint8_t)((t + 2) & Q_MASK);
+        TWCR = TWCR_GO;
+        break;
+
+    case 0x18: // SLA+W ACK
+    case 0x28: // DATA ACK
+        if (cur_left) {
+            TWDR = q[t];
+            q_tail = (uint8_t)((t + 1) & Q_MASK);
+            cur_left--;
+            TWCR = TWCR_GO;
+        } else {
+            twi_finish();
+        }
+        break;
+
+    case 0x20: // SLA+W NACK
+    case 0x30: // DATA NACK
+        stats.nack++;
+        twi_skip();
+        twi_finish();
+        break;
+
+    default:   // 0x00 bus error, 0x38 arbitration lost
+        stats.bus_err++;
+        twi_skip();
+        busy = 0;
+        TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWSTO);
+        break;
+    }
+    PROF_ISR_END(PROF_ISR_TWI);
+}
+
+static uint8_t twbr_val = 72;
+
 void twi_init(uint32_t scl_hz) {
     // Prescaler = 1
     TWSR = 0x00;
@@ -13,41 +114,197 @@ void twi_init(uint32_t scl_hz) {
     // => TWBR = ((F_CPU/SCL) - 16) / 2
     uint32_t twbr = ((F_CPU / scl_hz) - 16UL) / 2UL;
     if (twbr > 255) twbr = 255;
-    TWBR = (uint8_t)twbr;
+    twbr_val = (uint8_t)twbr;
+    TWBR = twbr_val;
 
     // Enable TWI
     TWCR = (1 << TWEN);
 }
 
-static uint8_t twi_wait(void) {
-    while (!(TWCR & (1 << TWINT))) {}
-    return (TWSR & 0xF8);
+uint8_t twi_free(void) {
+    return (uint8_t)((q_tail - q_head - 1) & Q_MASK);
+}
+
+uint8_t twi_busy(void) {
+    return busy || (q_head != q_tail);
+}
+
+uint8_t twi_bus_ok(void) {
+    return !bus_down;
+}
+
+// Kick a START if the engine is idle and something is queued
+static void twi_kick(void) {
+    uint8_t s = SREG;
+    cli();
+    if (!busy && q_tail != q_head) {
+        busy = 1;
+        cur_start = millis();
+        TWCR = TWCR_GO | (1 << TWSTA);
+    }
+    SREG = s;
+}
+
+// Open transaction being filled by twi_write_byte(), not yet visible to the ISR
+static uint8_t open_hdr = 0;
+static uint8_t open_h = 0;
+static uint8_t open_len = 0;
+static uint8_t open_on = 0;
+
+uint8_t twi_write_begin(uint8_t addr) {
+    if (bus_down || open_on) return 0;
+    if (twi_free() < 3) return 0;
+
+    open_hdr = q_head;
+    q[open_hdr] = addr;
+    open_h = (uint8_t)((open_hdr + 2) & Q_MASK);
+    open_len = 0;
+    open_on = 1;
+    return 1;
+}
+
+uint8_t twi_write_room(void) {
+    if (!open_on) return 0;
+    uint8_t room = (uint8_t)((q_tail - open_h - 1) & Q_MASK);
+    uint8_t cap = (uint8_t)(255 - open_len);
+    return (room < cap) ? room : cap;
+}
+
+uint8_t twi_write_byte(uint8_t b) {
+    if (!twi_write_room()) return 0;
+    q[open_h] = b;
+    open_h = (uint8_t)((open_h + 1) & Q_MASK);
+    open_len++;
+    return 1;
+}
+
+void twi_write_end(void) {
+    if (!open_on) return;
+    open_on = 0;
+    if (!open_len) return; // nothing to send, header slot stays free
+
+    q[(uint8_t)((open_hdr + 1) & Q_MASK)] = open_len;
+    q_head = open_h; // publish whole transaction at once
+    twi_kick();
+}
+
+uint8_t twi_queue_write(uint8_t addr, const uint8_t *data, uint8_t len) {
+    if (bus_down || open_on) return 0;
+    if ((uint16_t)len + 2 > twi_free()) return 0;
+
+    twi_write_begin(addr);
+    for (uint8_t i = 0; i < len; i++) twi_write_byte(data[i]);
+    twi_write_end();
+    return 1;
+}
+
+// Clock out a slave stuck mid-byte (up to 9 SCL pulses until SDA is
+// released), then a manual STOP. Returns 1 if both lines read high after.
+static uint8_t twi_recover(void) {
+    TWCR = 0; // hand the pins back to PORTC
+
+    DDRC &= ~((1 << SCL_BIT) | (1 << SDA_BIT));
+    PORTC |= (1 << SCL_BIT) | (1 << SDA_BIT);
+
+    for (uint8_t i = 0; i < 9 && !(PINC & (1 << SDA_BIT)); i++) {
+        PORTC &= ~(1 << SCL_BIT);
+        DDRC  |=  (1 << SCL_BIT);   // SCL low
+        _delay_us(5);
+        DDRC  &= ~(1 << SCL_BIT);
+        PORTC |=  (1 << SCL_BIT);   // release SCL
+        _delay_us(5);
+    }
+
+    // STOP: SDA low -> high while SCL is high
+    PORTC &= ~(1 << SDA_BIT);
+    DDRC  |=  (1 << SDA_BIT);
+    _delay_us(5);
+    DDRC  &= ~(1 << SDA_BIT);
+    PORTC |=  (1 << SDA_BIT);
+    _delay_us(5);
+
+    uint8_t ok = (PINC & (1 << SCL_BIT)) && (PINC & (1 << SDA_BIT));
+
+    TWSR = 0x00;
+    TWBR = twbr_val;
+    TWCR = (1 << TWEN);
+
+    stats.recover++;
+    return ok;
+}
+
+// Main loop context, TWI halted: throw away everything queued
+static void twi_drop_all(void) {
+    uint8_t t = q_tail;
+    if (cur_left) {
+        t = (uint8_t)((t + cur_left) & Q_MASK);
+        cur_left = 0;
+        stats.dropped++;
+    }
+    while (t != q_head) {
+        t = (uint8_t)((t + 2 + q[(uint8_t)((t + 1) & Q_MASK)]) & Q_MASK);
+        stats.dropped++;
+    }
+    q_tail = t;
 }
 
-uint8_t twi_start(uint8_t address_rw) {
-    // Send START
-    TWCR = (1 << TWINT) | (1 << TWSTA) | (1 << TWEN);
-    uint8_t st = twi_wait();
-    if (st != 0x08 && st != 0x10) return 0; // START / REPEATED START
+void twi_task(void) {
+    uint32_t now = millis();
+
+    if (bus_down) {
+        if ((int32_t)(now - bus_retry_at) < 0) return;
+        if (twi_recover()) bus_down = 0;
+        else bus_retry_at = now + TWI_RETRY_MS;
+        return;
+    }
+
+    uint8_t s = SREG;
+    cli();
+    uint8_t stuck = busy && (now - cur_start) > TWI_TIMEOUT_MS;
+    if (stuck) {
+        TWCR = 0; // no more TWI interrupts while we clean up
+        busy = 0;
+        stats.timeout++;
+        twi_drop_all();
+    }
+    SREG = s;
 
-    // Send SLA+W or SLA+R
-    TWDR = address_rw;
-    TWCR = (1 << TWINT) | (1 << TWEN);
-    st = twi_wait();
+    if (stuck) {
+        if (!twi_recover()) {
+            bus_down = 1;
+            bus_retry_at = now + TWI_RETRY_MS;
+        }
+        return;
+    }
 
-    // SLA+W ACK = 0x18, SLA+R ACK = 0x40
-    if (st != 0x18 && st != 0x40) return 0;
+    twi_kick(); // restart after a bus error left work queued
+}
+
+uint8_t twi_wait_room(uint8_t n, uint16_t max_ms) {
+    uint32_t t0 = millis();
+    while (twi_free() < n) {
+        twi_task();
+        if (bus_down || (millis() - t0) >= max_ms) return 0;
+    }
     return 1;
 }
 
-uint8_t twi_write(uint8_t data) {
-    TWDR = data;
-    TWCR = (1 << TWINT) | (1 << TWEN);
-    uint8_t st = twi_wait();
-    // DATA ACK = 0x28
-    return (st == 0x28);
+uint8_t twi_flush(uint16_t max_ms) {
+    uint32_t t0 = millis();
+    while (twi_busy()) {
+        twi_task();
+        if (bus_down || (millis() - t0) >= max_ms) return 0;
+    }
+    return 1;
 }
 
-void twi_stop(void) {
-    TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWSTO);
+void twi_get_stats(twi_stats_t *out) {
+    uint8_t s = SREG;
+    cli();
+    out->nack    = stats.nack;
+    out->bus_err = stats.bus_err;
+    out->timeout = stats.timeout;
+    out->recover = stats.recover;
+    out->dropped = stats.dropped;
+    SREG = s;
 }
@@ -3,16 +3,51 @@
 
 #include <stdint.h>
 
+// Interrupt-driven TWI (I2C) master, write-only transaction queue.
+// Transactions are copied into a ring and clocked out by TWI_vect in the
+// background; each one is START, SLA+W, data..., STOP.
+
 // Init AVR TWI (I2C) hardware at desired SCL (e.g., 100000)
 void twi_init(uint32_t scl_hz);
 
-// Start and address device: address_rw = (addr<<1)|0 for write, |1 for read
-uint8_t twi_start(uint8_t address_rw);
+// Queue a write of len bytes to 7-bit address addr (nonblocking).
+// Returns 1 if queued, 0 if the ring is full or the bus is down.
+uint8_t twi_queue_write(uint8_t addr, const uint8_t *data, uint8_t len);
+
+// Build a transaction in place (no staging copy):
+// twi_write_begin() reserves the header, twi_write_byte() appends while
+// twi_write_room() > 0, twi_write_end() hands it to the ISR. Only one
+// transaction can be open; an empty one is discarded on end.
+uint8_t twi_write_begin(uint8_t addr);
+uint8_t twi_write_room(void);
+uint8_t twi_write_byte(uint8_t b);
+void twi_write_end(void);
+
+// Bytes free in the ring (each transaction costs len + 2)
+uint8_t twi_free(void);
+
+// 1 while a transaction is on the wire or queued
+uint8_t twi_busy(void);
+
+// 0 after a failed bus recovery, until the next retry succeeds
+uint8_t twi_bus_ok(void);
+
+// Call from the main loop: transaction timeouts, bus recovery, restart.
+void twi_task(void);
+
+// Bounded waits (need interrupts enabled). Return 1 on success,
+// 0 on timeout or when the bus is down.
+uint8_t twi_wait_room(uint8_t n, uint16_t max_ms);
+uint8_t twi_flush(uint16_t max_ms);
 
-// Write one byte, returns 1 if ACK
-uint8_t twi_write(uint8_t data);
+typedef struct {
+    uint16_t nack;      // address or data not acknowledged
+    uint16_t bus_err;   // illegal START/STOP, arbitration lost
+    uint16_t timeout;   // transaction exceeded TWI_TIMEOUT_MS
+    uint16_t recover;   // bus recovery sequences run
+    uint16_t dropped;   // transactions discarded by any of the above
+} twi_stats_t;
 
-// Stop condition
-void twi_stop(void);
+void twi_get_stats(twi_stats_t *out);
 
 #endif
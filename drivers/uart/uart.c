@@ -1,54 +1,198 @@
 #include "uart.h"
+#include "sched.h"
+#include "prof.h"
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 
 #ifndef F_CPU
 #define F_CPU 16000000UL
 #endif
 
-#define RX_BUF_SZ 256
+// Rings: power of two, max 256 (uint8_t indices).
+// RX: 128 bytes is 130 ms of 9600 baud, 5 ms of 250000; every byte posts
+// SCHED_EV_UART_RX, so esp_task drains it well within that.
+// TX: must hold the largest single write (TSREQ_PART_SZ).
+#ifndef UART_RX_BUF_SZ
+#define UART_RX_BUF_SZ 128
+#endif
+#define RX_MASK (UART_RX_BUF_SZ - 1)
+
+#ifndef UART_TX_BUF_SZ
+#define UART_TX_BUF_SZ 128
+#endif
+#define TX_MASK (UART_TX_BUF_SZ - 1)
+
+#if (UART_RX_BUF_SZ & RX_MASK) || UART_RX_BUF_SZ > 256
+#error "UART_RX_BUF_SZ must be a power of two <= 256"
+#endif
+#if (UART_TX_BUF_SZ & TX_MASK) || UART_TX_BUF_SZ > 256
+#error "UART_TX_BUF_SZ must be a power of two <= 256"
+#endif
 
-static volatile uint8_t rx_buf[RX_BUF_SZ];
+static volatile uint8_t rx_buf[UART_RX_BUF_SZ];
 static volatile uint8_t rx_head = 0;
 static volatile uint8_t rx_tail = 0;
 
+static volatile uint8_t tx_buf[UART_TX_BUF_SZ];
+static volatile uint8_t tx_head = 0;   // written by main loop
+static volatile uint8_t tx_tail = 0;   // written by UDRE ISR
+static uint8_t tx_sent = 0;            // TXC0 is meaningful: written since uart_init
+
+static volatile uart_rx_stats_t rx_stats;
+
 ISR(USART_RX_vect) {
+    PROF_BEGIN();
+    // DOR0 is only valid before UDR0 is read: a byte was lost in hardware
+    if (UCSR0A & (1 << DOR0)) rx_stats.overruns++;
+
     uint8_t c = UDR0;
-    uint8_t next = (uint8_t)(rx_head + 1);
+    uint8_t next = (uint8_t)((rx_head + 1) & RX_MASK);
     if (next == rx_tail) {
         // overflow: drop byte
-        return;
+        rx_stats.dropped++;
+    } else {
+        rx_buf[rx_head] = c;
+        rx_head = next;
+        sched_post(SCHED_EV_UART_RX);
+    }
+    PROF_ISR_END(PROF_ISR_UART_RX);
+}
+
+ISR(USART_UDRE_vect) {
+    PROF_BEGIN();
+    uint8_t t = tx_tail;
+    if (t == tx_head) {
+        // ring drained: stop UDRE interrupts until more data is queued
+        UCSR0B &= ~(1 << UDRIE0);
+    } else {
+        UDR0 = tx_buf[t];
+        tx_tail = (uint8_t)((t + 1) & TX_MASK);
     }
-    rx_buf[rx_head] = c;
-    rx_head = next;
+    PROF_ISR_END(PROF_ISR_UART_TX);
+}
+
+// Closest UBRR for a rate in normal (16x) or double-speed (8x) mode.
+// Returns the error in permille.
+static uint16_t baud_calc(uint32_t baud, uint8_t u2x, uint16_t *ubrr) {
+    uint32_t div = u2x ? 8UL : 16UL;
+    uint32_t u = (F_CPU + div * baud / 2) / (div * baud);   // rounded
+    if (u == 0) u = 1;
+    if (u > 4096) u = 4096;
+    *ubrr = (uint16_t)(u - 1);
+
+    uint32_t actual = F_CPU / (div * u);
+    uint32_t diff = (actual > baud) ? actual - baud : baud - actual;
+    return (uint16_t)((diff * 1000UL + baud / 2) / baud);
+}
+
+// Normal mode samples each bit more often; U2X only when it is closer
+static uint16_t baud_pick(uint32_t baud, uint8_t *u2x, uint16_t *ubrr) {
+    uint16_t u1, u2;
+    uint16_t e1 = baud_calc(baud, 0, &u1);
+    uint16_t e2 = baud_calc(baud, 1, &u2);
+
+    *u2x = (e2 < e1);
+    *ubrr = *u2x ? u2 : u1;
+    return *u2x ? e2 : e1;
+}
+
+uint16_t uart_baud_error(uint32_t baud) {
+    uint8_t u2x;
+    uint16_t ubrr;
+    return baud_pick(baud, &u2x, &ubrr);
 }
 
-void uart_init(uint32_t baud) {
-    uint16_t ubrr = (uint16_t)((F_CPU / (16UL * baud)) - 1UL);
+uint8_t uart_init(uint32_t baud) {
+    uint8_t u2x;
+    uint16_t ubrr;
+    uint8_t ok = baud_pick(baud, &u2x, &ubrr) <= UART_BAUD_TOL;
+
+    // Quiet while switching: whatever is in flight at the old rate is lost
+    UCSR0B = 0;
 
     UBRR0H = (uint8_t)(ubrr >> 8);
     UBRR0L = (uint8_t)(ubrr & 0xFF);
 
-    UCSR0A = 0;
+    tx_head = 0;
+    tx_tail = 0;
+    tx_sent = 0;
+    rx_head = 0;
+    rx_tail = 0;
+
+    UCSR0A = u2x ? (1 << U2X0) : 0;
     UCSR0B = (1 << RXEN0) | (1 << TXEN0) | (1 << RXCIE0);  // RX/TX + RX interrupt
     UCSR0C = (1 << UCSZ01) | (1 << UCSZ00);                // 8N1
+    return ok;
+}
+
+uint8_t uart_tx_free(void) {
+    return (uint8_t)((tx_tail - tx_head - 1) & TX_MASK);
+}
+
+uint8_t uart_tx_busy(void) {
+    if ((tx_head != tx_tail) || (UCSR0B & (1 << UDRIE0))) return 1;
+    // Ring empty: the last byte may still be in the shift register
+    return tx_sent && !(UCSR0A & (1 << TXC0));
+}
+
+static uint8_t tx_queue(const char *buf, uint8_t len, uint8_t flash) {
+    uint8_t head = tx_head;
+    uint8_t n = 0;
+
+    while (n < len) {
+        uint8_t next = (uint8_t)((head + 1) & TX_MASK);
+        if (next == tx_tail) break; // full: caller retries later
+        tx_buf[head] = flash ? pgm_read_byte(buf + n) : (uint8_t)buf[n];
+        n++;
+        head = next;
+    }
+
+    if (n) {
+        // TXC0 is cleared by writing 1; keep U2X0, the other bits are flags
+        UCSR0A = (uint8_t)((UCSR0A & (1 << U2X0)) | (1 << TXC0));
+        tx_sent = 1;
+        tx_head = head;               // publish, then kick the ISR
+        UCSR0B |= (1 << UDRIE0);
+    }
+    return n;
+}
+
+uint8_t uart_write(const char *buf, uint8_t len) {
+    return tx_queue(buf, len, 0);
+}
+
+uint8_t uart_write_P(const char *p, uint8_t len) {
+    return tx_queue(p, len, 1);
 }
 
 void uart_putc(char c) {
-    while (!(UCSR0A & (1 << UDRE0))) {}
-    UDR0 = (uint8_t)c;
+    while (uart_write(&c, 1) == 0) {}
 }
 
 void uart_puts(const char *s) {
     while (*s) uart_putc(*s++);
 }
 
+void uart_puts_P(const char *p) {
+    char c;
+    while ((c = (char)pgm_read_byte(p++))) uart_putc(c);
+}
+
 uint8_t uart_available(void) {
     return (rx_head != rx_tail);
 }
 
 char uart_getc_nb(void) {
     char c = (char)rx_buf[rx_tail];
-    rx_tail = (uint8_t)(rx_tail + 1);
+    rx_tail = (uint8_t)((rx_tail + 1) & RX_MASK);
     return c;
 }
+
+void uart_rx_get_stats(uart_rx_stats_t *out) {
+    uint8_t s = SREG;
+    cli();
+    out->dropped  = rx_stats.dropped;
+    out->overruns = rx_stats.overruns;
+    SREG = s;
+}
@@ -3,12 +3,48 @@
 
 #include <stdint.h>
 
-void uart_init(uint32_t baud);
+// Largest rate error uart_init() accepts, permille. 2% is the datasheet's
+// limit for 8N1 against an exact peer; at 16 MHz it rules out 115200
+// (2.1%) but not 9600 (0.2%) or 250000 (exact).
+#ifndef UART_BAUD_TOL
+#define UART_BAUD_TOL 20
+#endif
+
+// Picks normal or U2X double-speed mode, whichever gets closer to the rate.
+// Returns 0 if even that is off by more than UART_BAUD_TOL (the UART is set
+// up anyway: the peer may be off the other way). May be called again to
+// change the rate; both rings are emptied, and a byte still shifting out is
+// cut off.
+uint8_t uart_init(uint32_t baud);
 
+// Error uart_init() would get for a rate, permille
+uint16_t uart_baud_error(uint32_t baud);
+
+// TX is interrupt driven (UDRE0) through a ring buffer.
+// uart_putc/uart_puts wait only while the ring is full.
 void uart_putc(char c);
 void uart_puts(const char *s);
+void uart_puts_P(const char *p);    // string in flash (PSTR)
+
+// Nonblocking: queues as many bytes as fit, returns how many were taken.
+uint8_t uart_write(const char *buf, uint8_t len);
+uint8_t uart_write_P(const char *p, uint8_t len);
+
+// Free space in the TX ring (bytes). Check before uart_write to send all-or-nothing.
+uint8_t uart_tx_free(void);
+
+// 1 while bytes are still queued or shifting out (TXC0 not yet set after
+// the last one). Check before uart_init() changes the rate.
+uint8_t uart_tx_busy(void);
 
 uint8_t uart_available(void);
 char uart_getc_nb(void);     // nonblocking: call only if uart_available()
 
+typedef struct {
+    uint16_t dropped;   // bytes thrown away because the RX ring was full
+    uint16_t overruns;  // bytes lost in hardware before the RX ISR ran (DOR0)
+} uart_rx_stats_t;
+
+void uart_rx_get_stats(uart_rx_stats_t *out);
+
 #endif
@@ -0,0 +1,547 @@
+// Host benchmark for the decision pipeline and the other pure-logic paths.
+//
+//   make host
+//   host/bench [-n samples] [-c confirm] [-f recorded.txt]
+//
+// -f takes recorded raw readings in cm, the first number on each line
+// (a one-column export; lines without a number are skipped). -1 or 0 marks
+// a timeout. Readings are assumed 50 ms apart.
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#include "hal.h"
+#include "level.h"
+#include "buzzer.h"
+#include "lcd_i2c.h"
+#include "lcd_fb.h"
+#include "esp.h"
+#include "store.h"
+#include "agg.h"
+#include "clock.h"
+#include "uart.h"
+#include "timebase.h"
+#include "twi.h"
+#include "sensor.h"
+#include "fmt.h"
+
+#define SAMPLE_MS 50
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// Keeps results alive so the optimiser cannot drop the work
+static volatile uint32_t sink;
+
+//---------------------------------------------------------------------------
+// Sample sources
+
+// Slow river: level drifts with occasional floods, sensor noise, echo
+// timeouts and the odd spike from debris or rain.
+static int16_t *synth_samples(size_t n) {
+    int16_t *s = malloc(n * sizeof(*s));
+    if (!s) return 0;
+
+    uint32_t rng = 12345;
+    double level = 120.0;
+    double target = 120.0;
+
+    for (size_t i = 0; i < n; i++) {
+        rng = rng * 1664525u + 1013904223u;
+        uint32_t r = rng >> 8;
+
+        if (r % 20000 == 0) target = 15 + (r >> 4) % 60;          // flood
+        else if (r % 20000 == 1) target = 80 + (r >> 4) % 200;    // recede
+        level += (target - level) * 0.0005 + ((double)(r % 201) - 100.0) * 0.002;
+
+        int16_t v = (int16_t)(level + (double)((r >> 3) % 7) - 3.0);
+        if (r % 100 < 5) v = -1;                  // timeout
+        else if ((r >> 7) % 1000 < 5) v = (int16_t)(5 + (r >> 5) % 390); // spike
+        s[i] = v;
+    }
+    return s;
+}
+
+static int16_t *load_samples(const char *path, size_t *n_out) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return 0;
+
+    size_t cap = 1 << 20, n = 0;
+    int16_t *s = malloc(cap * sizeof(*s));
+    char line[128];
+
+    while (s && fgets(line, sizeof(line), f)) {
+        char *end;
+        long v = strtol(line, &end, 10);
+        if (end == line) continue; // header or blank
+        if (n == cap) {
+            cap *= 2;
+            int16_t *g = realloc(s, cap * sizeof(*s));
+            if (!g) { free(s); s = 0; break; }
+            s = g;
+        }
+        s[n++] = (int16_t)((v < -1 || v > 32767) ? -1 : v);
+    }
+    fclose(f);
+    *n_out = n;
+    return s;
+}
+
+//---------------------------------------------------------------------------
+// Decision pipeline
+
+static void bench_pipeline(const char *name, const int16_t *s, size_t n, uint8_t confirm) {
+    level_t lv;
+    level_init(&lv);
+    lv.confirm = confirm;
+
+    uint32_t transitions = 0;
+    uint64_t in_state[3] = {0, 0, 0};
+    uint8_t prev = lv.active_state;
+
+    double t0 = now_s();
+    for (size_t i = 0; i < n; i++) {
+        uint8_t st = level_update(&lv, s[i]);
+        in_state[st]++;
+        if (st != prev) {
+            transitions++;
+            prev = st;
+        }
+    }
+    double dt = now_s() - t0;
+
+    double hours = (double)n * SAMPLE_MS / 3600000.0;
+    printf("%-10s %10zu samples (%.1f h of data, MEDIAN_N=%d, confirm=%u)\n",
+           name, n, hours, MEDIAN_N, (unsigned)confirm);
+    printf("           %8.1f ns/sample  %12.0f decisions/s  %.3f s\n",
+           dt * 1e9 / (double)n, (double)n / dt, dt);
+    printf("           %u transitions, SAFE %.2f%%  PREPARE %.2f%%  EVAC %.2f%%\n",
+           transitions,
+           100.0 * (double)in_state[STATE_SAFE] / (double)n,
+           100.0 * (double)in_state[STATE_PREPARE] / (double)n,
+           100.0 * (double)in_state[STATE_EVAC] / (double)n);
+}
+
+//---------------------------------------------------------------------------
+// Other pure-logic paths, per call
+
+// The 1 kHz step interrupt, playing the siren (the main code only selects)
+static void bench_buzzer(void) {
+    const uint32_t n = 10000000;
+    uint32_t acc = 0;
+
+    buzzer_init();
+    buzzer_play(BUZZER_SIREN);
+
+    double t0 = now_s();
+    for (uint32_t t = 0; t < n; t++) {
+        hal_isr_TIMER0_COMPB_vect();
+        acc += OCR2A;
+    }
+    double dt = now_s() - t0;
+
+    buzzer_play(BUZZER_OFF);
+    hal_isr_TIMER0_COMPB_vect();
+
+    sink = acc;
+    printf("buzzer     %8.1f ns/step interrupt\n", dt * 1e9 / n);
+}
+
+static void bench_lcd(void) {
+    const uint32_t n = 200000;
+    hal_twi_stats_t a, b;
+
+    lcd_init();
+    lcd_fb_init();
+    hal_twi_get_stats(&a);
+
+    double t0 = now_s();
+    for (uint32_t i = 0; i < n; i++) {
+        char row[LCD_FB_COLS + 1];
+        fmt_t f;
+        fmt_init(&f, row, sizeof(row));
+        fmt_P(&f, PSTR("Level: "));
+        fmt_u_w(&f, i % 400, 3);
+        fmt_P(&f, PSTR(" cm"));
+        lcd_fb_set_row(0, row);
+        lcd_fb_set_row_P(1, level_label_P((uint8_t)((i / 50) % 3)));
+        lcd_fb_flush();
+    }
+    double dt = now_s() - t0;
+
+    hal_twi_get_stats(&b);
+    printf("lcd        %8.1f ns/refresh (format + diff + queue), %.1f I2C bytes/refresh\n",
+           dt * 1e9 / n, (double)(b.bytes - a.bytes) / n);
+}
+
+// Time to first alert from reset, on the simulated clock: one sensor sees
+// EVACUATE-level water and pings at the full rate (guard time plus the
+// echo), while the LCD runs its power-on sequence from the 4 ms I/O task.
+// No WiFi: the ESP does not take part.
+static void bench_boot(void) {
+    const int16_t cm = LEVEL_EVAC_MAX_CM - 5;
+    const uint32_t round_ms = SENSOR_GUARD_MS + 2;
+    level_t lv;
+    uint32_t alert = 0, lcd = 0;
+
+    hal_reset();
+    level_init(&lv);
+    lcd_init();
+
+    for (uint32_t t = 1; t <= 5000 && !(alert && lcd); t++) {
+        hal_advance_ms(1);
+        if (t % round_ms == 0) {
+            level_update(&lv, cm);
+            if (!alert && lv.live) alert = t;
+        }
+        if (t % 4 == 0 && !lcd && lcd_task()) lcd = t;
+    }
+    printf("boot       first alert %u ms, LCD ready %u ms (simulated, %s)\n",
+           (unsigned)alert, (unsigned)lcd,
+           (lv.active_state == STATE_EVAC) ? "EVACUATE" : "wrong state");
+}
+
+// Scripted ESP8266 (AT+CIPMUX=1): answers each AT command line with OK,
+// CIPDOMAIN with an address, CIPSNTPTIME with a date, CIPSTATUS with the
+// open cloud link, CIPSTART with CONNECT, CIPSEND with the prompt, and the announced number of payload
+// bytes with SEND OK, plus a 200 response on the cloud link (429 while
+// esp_reject counts down; with ESP_MQTT=1, a broker's CONNACK / PUBACK /
+// PINGRESP). Payload sent to a LAN client is kept in lan_out.
+static char esp_line[300];
+static uint16_t esp_len = 0;
+static uint16_t esp_payload = 0;
+static uint8_t esp_link = 0;
+static uint8_t esp_cloud_open = 0;
+static uint32_t esp_requests = 0;
+static uint32_t esp_cloud_bytes = 0;    // request / packet bytes sent upstream
+static uint8_t esp_reject = 0;          // HTTP requests still to answer with 429
+static char lan_out[300];
+static uint16_t lan_out_len = 0;
+static uint8_t cloud_out[300];
+static uint16_t cloud_len = 0;
+
+// MQTT broker: answers the packet in cloud_out
+static void broker_reply(void) {
+    static const char ipd[] = "+IPD,4,4:";
+    uint8_t r[4 + sizeof(ipd)];
+    uint8_t n = 0;
+
+    memcpy(r, ipd, sizeof(ipd) - 1);
+    switch (cloud_out[0] >> 4) {
+    case 1:     // CONNECT -> CONNACK, accepted
+        memcpy(r + sizeof(ipd) - 1, "\x20\x02\x00\x00", 4);
+        n = 4;
+        break;
+    case 3: {   // PUBLISH -> PUBACK with its packet id (QoS 1)
+        esp_requests++;
+        if (!(cloud_out[0] & 0x06)) break;
+        uint8_t *p = cloud_out + ((cloud_out[1] & 0x80) ? 3 : 2);
+        p += 2 + (p[0] << 8 | p[1]);
+        r[sizeof(ipd) - 1] = 0x40;
+        r[sizeof(ipd)] = 0x02;
+        r[sizeof(ipd) + 1] = p[0];
+        r[sizeof(ipd) + 2] = p[1];
+        n = 4;
+        break;
+    }
+    case 12:    // PINGREQ -> PINGRESP
+        r[sizeof(ipd) - 3] = '2';  // +IPD length
+        r[sizeof(ipd) - 1] = 0xD0;
+        r[sizeof(ipd)] = 0x00;
+        n = 2;
+        break;
+    }
+    if (n) hal_uart_rx_n(r, (uint16_t)(sizeof(ipd) - 1 + n));
+}
+
+static void esp_model(uint8_t c) {
+    if (esp_payload) {
+        if (esp_link == ESP_CLOUD_LINK) esp_cloud_bytes++;
+        if (esp_link != ESP_CLOUD_LINK && lan_out_len < sizeof(lan_out) - 1) {
+            lan_out[lan_out_len++] = (char)c;
+            lan_out[lan_out_len] = '\0';
+        } else if (esp_link == ESP_CLOUD_LINK && cloud_len < sizeof(cloud_out)) {
+            cloud_out[cloud_len++] = c;
+        }
+        if (--esp_payload == 0) {
+            if (ESP_MQTT && esp_link == ESP_CLOUD_LINK) {
+                hal_uart_rx("\r\nSEND OK\r\n");
+                broker_reply();
+            } else if (esp_link == ESP_CLOUD_LINK) {
+                esp_requests++;
+                if (esp_reject) {
+                    esp_reject--;
+                    hal_uart_rx("\r\nSEND OK\r\n\r\n+IPD,4,32:HTTP/1.1 429 Too Many Requests\r\n");
+                } else {
+                    hal_uart_rx("\r\nSEND OK\r\n\r\n+IPD,4,17:HTTP/1.1 200 OK\r\n");
+                }
+            } else {
+                hal_uart_rx("\r\nSEND OK\r\n");
+            }
+        }
+        return;
+    }
+
+    if (esp_len < sizeof(esp_line) - 1) esp_line[esp_len++] = (char)c;
+    if (c != '\n') return;
+    esp_line[esp_len] = '\0';
+    esp_len = 0;
+
+    if (strncmp(esp_line, "AT+CIPSTART", 11) == 0) {
+        esp_cloud_open = 1;
+        hal_uart_rx("4,CONNECT\r\n\r\nOK\r\n");
+    }
+    else if (strncmp(esp_line, "AT+CIPSTATUS", 12) == 0) {
+        hal_uart_rx(esp_cloud_open ? "STATUS:3\r\n+CIPSTATUS:4,\"TCP\",\"184.106.153.149\",80,49152,0\r\n\r\nOK\r\n"
+                                   : "STATUS:2\r\n\r\nOK\r\n");
+    }
+    else if (strncmp(esp_line, "AT+CIPCLOSE=", 12) == 0) {
+        char reply[20];
+        if (esp_line[12] == '4') esp_cloud_open = 0;
+        snprintf(reply, sizeof(reply), "%c,CLOSED\r\n\r\nOK\r\n", esp_line[12]);
+        hal_uart_rx(reply);
+    }
+    else if (strncmp(esp_line, "AT+CIPDOMAIN", 12) == 0) hal_uart_rx("+CIPDOMAIN:184.106.153.149\r\n\r\nOK\r\n");
+    else if (strncmp(esp_line, "AT+CIPSNTPTIME?", 15) == 0) hal_uart_rx("+CIPSNTPTIME:Sat Oct 17 10:00:00 2026\r\nOK\r\n");
+    else if (strncmp(esp_line, "AT+CIPSEND=", 11) == 0) {
+        esp_link = (uint8_t)atoi(esp_line + 11);
+        esp_payload = (uint16_t)atoi(strchr(esp_line, ',') + 1);
+        cloud_len = 0;
+        hal_uart_rx("\r\nOK\r\n> ");
+    }
+    else if (strncmp(esp_line, "AT", 2) == 0) hal_uart_rx("\r\nOK\r\n");
+}
+
+// Runs esp_task() until the store is empty, with 1 ms of simulated time
+// per pass. Returns the number of passes.
+static uint32_t esp_drain(void) {
+    uint32_t passes = 0;
+    do {
+        esp_task();
+        store_task();
+        hal_advance_ms(1);
+        passes++;
+    } while (store_count() || esp_is_uploading());
+    return passes;
+}
+
+// One interval of 400 samples around cm
+static void push_reading(int16_t cm) {
+    agg_t a;
+    reading_t r;
+    uint32_t t = millis();
+
+    agg_init(&a, t);
+    for (uint16_t k = 0; k < 400; k++) agg_add(&a, (int16_t)(cm + (k % 7) - 3), STATE_SAFE, t + k * 50UL);
+    r.ts = clock_stamp();
+    agg_close(&a, t + 20000UL, &r);
+    store_push(&r);
+}
+
+// A confirmed change to EVACUATE, as main.c queues it. Returns the simulated
+// ms until the server has it.
+static uint32_t push_alert(void) {
+    agg_t a;
+    reading_t r;
+    uint32_t t = millis();
+
+    agg_init(&a, t);
+    agg_add(&a, 25, STATE_EVAC, t);
+    r.ts = clock_stamp();
+    agg_close(&a, t, &r);
+    r.status = STATE_EVAC;
+    store_push_alert(&r);
+    while (store_alert_pending()) {
+        esp_task();
+        hal_advance_ms(1);
+    }
+    return millis() - t;
+}
+
+static void bench_status(fmt_t *f) {
+    fmt_P(f, PSTR("{\"cm\":"));
+    fmt_u(f, 41);
+    fmt_P(f, PSTR(",\"state\":\"SAFE\"}\n"));
+}
+
+static void bench_esp(void) {
+    hal_uart_set_tx_hook(esp_model);
+    uart_init(9600);
+    clock_init(store_init());
+    esp_set_thingspeak("KEY", "1");
+    esp_set_status(bench_status);
+    esp_begin("ssid", "pass");
+
+    for (int i = 0; i < 1000 && !esp_ready(); i++) {
+        esp_task();
+        hal_advance_ms(1);
+    }
+    if (!esp_ready() || !clock_synced()) {
+        printf("esp        did not reach READY with the clock set\n");
+        return;
+    }
+
+    const uint32_t idle_n = 5000000;
+    double t0 = now_s();
+    for (uint32_t i = 0; i < idle_n; i++) esp_task();
+    double idle = now_s() - t0;
+
+    // Steady state: one reading per upload interval
+    const uint32_t up_n = 2000;
+    uint32_t passes = 0;
+    uint32_t req0 = esp_requests;
+    uint32_t bytes0 = esp_cloud_bytes;
+    t0 = now_s();
+    for (uint32_t i = 0; i < up_n; i++) {
+        push_reading((int16_t)(i % 400));
+        hal_advance_ms(20000);
+        passes += esp_drain();
+    }
+    double up = now_s() - t0;
+    uint32_t up_req = esp_requests - req0;
+    uint32_t up_bytes = esp_cloud_bytes - bytes0;
+
+    // Backfill after an outage: the store full (SRAM + EEPROM ring)
+    store_stats_t ss;
+    store_get_stats(&ss);
+    uint16_t backlog = (uint16_t)(ss.ee_slots + STORE_RAM_N);
+    uint32_t span_safe = 0, span_evac = 0;    // outage it covers, main.c's intervals
+    for (uint16_t i = 0; i < backlog; i++) {
+        span_safe += store_log_interval(60000UL);
+        span_evac += store_log_interval(15000UL);
+        push_reading((int16_t)(i % 400));
+        hal_advance_ms(20000);
+        for (uint8_t k = 0; k < 64; k++) store_task();    // EEPROM spill
+    }
+    req0 = esp_requests;
+    uint32_t t_ms = millis();
+    (void)esp_drain();
+    t_ms = millis() - t_ms;
+    uint32_t backfill_req = esp_requests - req0;
+
+    // The server rate-limits a request: its readings stay queued and go out
+    // with the next one
+    esp_stats_t es0, es;
+    esp_get_stats(&es0);
+    for (uint8_t i = 0; i < 3; i++) push_reading(41);
+    hal_advance_ms(ESP_MIN_INTERVAL_MS);
+    esp_reject = ESP_MQTT ? 0 : 1;
+    req0 = esp_requests;
+    uint32_t reject_ms = millis();
+    (void)esp_drain();
+    reject_ms = millis() - reject_ms;
+    uint32_t reject_req = esp_requests - req0;
+    esp_get_stats(&es);
+    uint16_t rejects = (uint16_t)(es.http_rejects - es0.http_rejects);
+
+    // A status client on the LAN while idle: time from its request to the
+    // ESP's SEND OK for the reply
+    static const char get[] = "GET /status HTTP/1.1\r\nHost: station\r\nAccept: */*\r\n\r\n";
+    char ipd[160];
+    snprintf(ipd, sizeof(ipd), "0,CONNECT\r\n\r\n+IPD,0,%u:%s", (unsigned)strlen(get), get);
+    esp_get_stats(&es0);
+    lan_out_len = 0;
+    hal_uart_rx(ipd);
+    uint32_t lan_ms = 0;
+    do {
+        esp_task();
+        hal_advance_ms(1);
+        esp_get_stats(&es);
+    } while (es.lan_replies == es0.lan_replies && ++lan_ms < 1000);
+    char *body = strstr(lan_out, "\r\n\r\n");
+
+    // Alerts: a state change k s after a routine upload, at the SAFE cadence
+    // (one reading a minute), then one behind a backlog
+    uint32_t alert_sum = 0, alert_max = 0;
+    for (uint32_t k = 1; k < 60; k++) {
+        push_reading(41);
+        (void)esp_drain();
+        hal_advance_ms(k * 1000);
+        uint32_t d = push_alert();
+        alert_sum += d;
+        if (d > alert_max) alert_max = d;
+        hal_advance_ms((60 - k) * 1000);
+    }
+    // Right after the first request of a backfill: the alert still goes
+    // next, not after the rest of the backlog
+    for (uint16_t i = 0; i < backlog; i++) {
+        push_reading(41);
+        for (uint8_t k = 0; k < 64; k++) store_task();
+    }
+    hal_advance_ms(ESP_MIN_INTERVAL_MS);
+    req0 = esp_requests;
+    while (esp_requests == req0 || esp_is_uploading()) {
+        esp_task();
+        hal_advance_ms(1);
+    }
+    uint16_t behind = store_count();
+    uint32_t alert_backlog = push_alert();
+    (void)esp_drain();
+
+    hal_uart_set_tx_hook(0);
+    printf("esp        %8.1f ns/esp_task (idle), %.1f us CPU/upload over %.1f passes, %.2f requests/reading\n",
+           idle * 1e9 / idle_n, up * 1e6 / up_n, (double)passes / up_n, (double)up_req / up_n);
+    printf("esp        %s: %.0f bytes sent per reading\n", ESP_MQTT ? "MQTT" : "HTTP", (double)up_bytes / up_n);
+    printf("esp        backfill of %u readings (%.1f h of outage while SAFE, %.1f h in EVACUATE): %lu requests, %.1f s\n",
+           (unsigned)backlog, span_safe / 3.6e6, span_evac / 3.6e6, (unsigned long)backfill_req, t_ms / 1000.0);
+    if (!ESP_MQTT) {
+        printf("esp        429 answer: %u rejected, 3 readings kept and sent %.1f s later (%lu requests)\n",
+               (unsigned)rejects, reject_ms / 1000.0, (unsigned long)reject_req);
+    }
+    printf("alert      to the server in %.1f s avg, %.1f s worst (simulated, SAFE cadence); "
+           "%.1f s with %u readings queued\n",
+           alert_sum / 59000.0, alert_max / 1000.0, alert_backlog / 1000.0, (unsigned)behind);
+    printf("lan        GET /status answered in %u ms (simulated): %s",
+           (unsigned)lan_ms, body ? body + 4 : "no reply\n");
+}
+
+//---------------------------------------------------------------------------
+
+int main(int argc, char **argv) {
+    size_t n = 5000000;
+    uint8_t confirm = CONFIDENCE_THRESHOLD;
+    const char *file = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc) n = strtoul(argv[++i], 0, 10);
+        else if (!strcmp(argv[i], "-c") && i + 1 < argc) confirm = (uint8_t)atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-f") && i + 1 < argc) file = argv[++i];
+        else {
+            fprintf(stderr, "usage: %s [-n samples] [-c confirm] [-f recorded.txt]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    hal_reset();
+
+    int16_t *s = synth_samples(n);
+    if (!s) return 1;
+    bench_pipeline("synthetic", s, n, confirm);
+    free(s);
+
+    if (file) {
+        size_t m = 0;
+        s = load_samples(file, &m);
+        if (!s || !m) {
+            fprintf(stderr, "cannot read samples from %s\n", file);
+            return 1;
+        }
+        bench_pipeline("recorded", s, m, confirm);
+        free(s);
+    }
+
+    bench_boot();
+    bench_buzzer();
+    bench_lcd();
+    bench_esp();
+    return 0;
+}
@@ -0,0 +1,18 @@
+#ifndef HAL_AVR_EEPROM_H
+#define HAL_AVR_EEPROM_H
+
+// Host shim for <avr/eeprom.h>: 1 KB array in hal.c, writes complete at once
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint8_t eeprom_read_byte(const uint8_t *p);
+void eeprom_write_byte(uint8_t *p, uint8_t v);
+void eeprom_update_byte(uint8_t *p, uint8_t v);
+void eeprom_read_block(void *dst, const void *src, size_t n);
+void eeprom_update_block(const void *src, void *dst, size_t n);
+
+#define eeprom_is_ready() 1
+#define eeprom_busy_wait() ((void)0)
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef HAL_AVR_INTERRUPT_H
+#define HAL_AVR_INTERRUPT_H
+
+#include <avr/io.h>
+
+// ISRs become ordinary functions the host models call (hal.c)
+#define ISR(vect) void hal_isr_##vect(void)
+
+// Single-threaded host: nothing to mask
+#define sei() ((void)0)
+#define cli() ((void)0)
+
+#endif
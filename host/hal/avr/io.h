@@ -0,0 +1,151 @@
+#ifndef HAL_AVR_IO_H
+#define HAL_AVR_IO_H
+
+// Host shim for <avr/io.h>: ATmega328P registers as plain variables
+// (storage in hal.c) with the real bit numbers, so the drivers compile
+// unmodified with the native compiler.
+
+#include <stdint.h>
+
+#define _BV(b) (1 << (b))
+
+#define HAL_REGS(R8, R16) \
+    R8(UDR0) R8(UBRR0H) R8(UBRR0L) R8(UCSR0A) R8(UCSR0B) R8(UCSR0C) \
+    R8(TCCR0A) R8(TCCR0B) R8(OCR0A) R8(OCR0B) R8(TIMSK0) R8(TCNT0) R8(TIFR0) \
+    R8(TCCR1A) R8(TCCR1B) R8(TCCR1C) R16(TCNT1) R16(OCR1A) R16(OCR1B) R16(ICR1) \
+    R8(TIFR1) R8(TIMSK1) \
+    R8(TCCR2A) R8(TCCR2B) R8(OCR2A) R8(OCR2B) R8(TIMSK2) R8(TCNT2) R8(TIFR2) \
+    R8(DDRB) R8(PORTB) R8(PINB) R8(DDRC) R8(PORTC) R8(PINC) R8(DDRD) R8(PORTD) R8(PIND) \
+    R8(TWSR) R8(TWBR) R8(TWCR) R8(TWDR) \
+    R8(SREG) R8(PCICR) R8(PCIFR) R8(PCMSK0) R8(PCMSK1) R8(PCMSK2) \
+    R8(SMCR) R8(MCUSR) R8(WDTCSR) R8(PRR)
+
+#define HAL_EXTERN8(n)  extern volatile uint8_t n;
+#define HAL_EXTERN16(n) extern volatile uint16_t n;
+HAL_REGS(HAL_EXTERN8, HAL_EXTERN16)
+
+// USART0
+#define RXC0    7
+#define TXC0    6
+#define UDRE0   5
+#define FE0     4
+#define DOR0    3
+#define UPE0    2
+#define U2X0    1
+#define RXCIE0  7
+#define TXCIE0  6
+#define UDRIE0  5
+#define RXEN0   4
+#define TXEN0   3
+#define UCSZ01  2
+#define UCSZ00  1
+
+// Timer0
+#define WGM01   1
+#define WGM00   0
+#define CS02    2
+#define CS01    1
+#define CS00    0
+#define OCIE0B  2
+#define OCIE0A  1
+#define TOIE0   0
+#define OCF0B   2
+#define OCF0A   1
+#define TOV0    0
+
+// Timer1
+#define COM1A1  7
+#define COM1A0  6
+#define COM1B1  5
+#define COM1B0  4
+#define WGM11   1
+#define WGM10   0
+#define ICNC1   7
+#define ICES1   6
+#define WGM13   4
+#define WGM12   3
+#define CS12    2
+#define CS11    1
+#define CS10    0
+#define FOC1A   7
+#define FOC1B   6
+#define ICIE1   5
+#define OCIE1B  2
+#define OCIE1A  1
+#define TOIE1   0
+#define ICF1    5
+#define OCF1B   2
+#define OCF1A   1
+#define TOV1    0
+
+// Timer2
+#define COM2A1  7
+#define COM2A0  6
+#define COM2B1  5
+#define COM2B0  4
+#define WGM21   1
+#define WGM20   0
+#define WGM22   3
+#define CS22    2
+#define CS21    1
+#define CS20    0
+#define OCIE2B  2
+#define OCIE2A  1
+#define TOIE2   0
+#define OCF2B   2
+#define OCF2A   1
+#define TOV2    0
+
+// TWI
+#define TWINT   7
+#define TWEA    6
+#define TWSTA   5
+#define TWSTO   4
+#define TWWC    3
+#define TWEN    2
+#define TWIE    0
+#define TWPS1   1
+#define TWPS0   0
+
+// Pin change, sleep, reset flags
+#define PCIE2   2
+#define PCIE1   1
+#define PCIE0   0
+#define PCIF2   2
+#define PCIF1   1
+#define PCIF0   0
+#define SE      0
+#define PORF    0
+#define EXTRF   1
+#define BORF    2
+#define WDRF    3
+
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC3 3
+#define PC4 4
+#define PC5 5
+#define PC6 6
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+
+#define RAMSTART 0x0100
+#define RAMEND   0x08FF
+#define E2END    0x03FF
+
+#endif
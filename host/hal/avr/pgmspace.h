@@ -0,0 +1,26 @@
+#ifndef HAL_AVR_PGMSPACE_H
+#define HAL_AVR_PGMSPACE_H
+
+// Host shim for <avr/pgmspace.h>: one address space, flash reads are plain
+// loads and the _P functions are their RAM counterparts
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define PGM_P const char *
+
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define pgm_read_dword(p) (*(const uint32_t *)(p))
+#define pgm_read_ptr(p)  (*(const void * const *)(p))
+
+#define strlen_P    strlen
+#define strncmp_P   strncmp
+#define memcpy_P    memcpy
+#define snprintf_P  snprintf
+#define vsnprintf_P vsnprintf
+
+#endif
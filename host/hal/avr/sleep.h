@@ -0,0 +1,13 @@
+#ifndef HAL_AVR_SLEEP_H
+#define HAL_AVR_SLEEP_H
+
+// Host shim for <avr/sleep.h>: nothing to power down
+
+#define SLEEP_MODE_IDLE 0
+
+#define set_sleep_mode(m) ((void)(m))
+#define sleep_enable()    ((void)0)
+#define sleep_disable()   ((void)0)
+#define sleep_cpu()       ((void)0)
+
+#endif
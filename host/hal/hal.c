@@ -0,0 +1,152 @@
+#include "hal.h"
+#include "timebase.h"
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <string.h>
+
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+
+#define HAL_DEFINE8(n)  volatile uint8_t n;
+#define HAL_DEFINE16(n) volatile uint16_t n;
+HAL_REGS(HAL_DEFINE8, HAL_DEFINE16)
+
+static uint8_t eeprom[E2END + 1];
+
+static uint32_t hal_ms = 0;
+static uint8_t in_models = 0;
+
+static hal_uart_tx_hook_t tx_hook = 0;
+
+static hal_twi_stats_t twi_stats;
+static uint8_t twi_phase = 0;   // 0 idle, 1 START sent, 2 SLA+W sent, 3 data
+
+// timebase.c is replaced on the host
+void timebase_init(void) {}
+
+uint32_t millis(void) {
+    hal_run();
+    return hal_ms;
+}
+
+// Simulated time moves in whole ms: sections that do not wait measure 0
+uint32_t micros(void) {
+    return millis() * 1000UL;
+}
+
+uint32_t cycles(void) {
+    return millis() * (F_CPU / 1000UL);
+}
+
+void hal_reset(void) {
+    hal_ms = 0;
+    hal_eeprom_erase();
+    twi_phase = 0;
+    memset(&twi_stats, 0, sizeof(twi_stats));
+    PINC = (1 << PC4) | (1 << PC5);   // idle I2C bus reads high
+}
+
+void hal_advance_ms(uint32_t ms) {
+    hal_ms += ms;
+    hal_run();
+}
+
+void hal_uart_set_tx_hook(hal_uart_tx_hook_t hook) {
+    tx_hook = hook;
+}
+
+void hal_uart_rx(const char *s) {
+    hal_uart_rx_n(s, (uint16_t)strlen(s));
+}
+
+void hal_uart_rx_n(const void *p, uint16_t n) {
+    const uint8_t *b = p;
+    while (n--) {
+        UDR0 = *b++;
+        hal_isr_USART_RX_vect();
+    }
+}
+
+void hal_twi_get_stats(hal_twi_stats_t *out) {
+    *out = twi_stats;
+}
+
+// The UDRE ISR either writes UDR0 or, when its ring is empty, clears UDRIE0.
+// Bytes leave at once, so TXC0 is set as soon as the ring has drained.
+static uint8_t uart_model(void) {
+    uint8_t did = 0;
+    while (UCSR0B & (1 << UDRIE0)) {
+        hal_isr_USART_UDRE_vect();
+        if (!(UCSR0B & (1 << UDRIE0))) break;
+        if (tx_hook) tx_hook(UDR0);
+        did = 1;
+    }
+    if (did) UCSR0A |= (1 << TXC0);
+    return did;
+}
+
+// TWCR with TWINT written as 1 is a request; complete it, set the status
+// and run the ISR with TWINT cleared so a new request can be spotted.
+static uint8_t twi_model(void) {
+    uint8_t did = 0;
+
+    while ((TWCR & (1 << TWEN)) && (TWCR & (1 << TWINT))) {
+        uint8_t cr = TWCR;
+        did = 1;
+
+        if (cr & (1 << TWSTO)) {
+            twi_phase = 0;
+            if (!(cr & (1 << TWSTA))) {
+                TWCR = (uint8_t)(cr & ~((1 << TWSTO) | (1 << TWINT)));
+                break;
+            }
+        }
+
+        if (cr & (1 << TWSTA)) {
+            TWSR = (twi_phase == 0) ? 0x08 : 0x10;
+            twi_phase = 1;
+            twi_stats.transactions++;
+        } else if (twi_phase == 1) {
+            TWSR = 0x18;    // SLA+W ACK
+            twi_phase = 2;
+        } else {
+            TWSR = 0x28;    // DATA ACK
+            twi_phase = 3;
+            twi_stats.bytes++;
+        }
+
+        TWCR = (uint8_t)(cr & ~((1 << TWINT) | (1 << TWSTA) | (1 << TWSTO)));
+        if (cr & (1 << TWIE)) hal_isr_TWI_vect();
+        else break;
+    }
+    return did;
+}
+
+void hal_run(void) {
+    if (in_models) return; // ISRs may call millis()
+    in_models = 1;
+    while (uart_model() | twi_model()) {}
+    in_models = 0;
+}
+
+// EEPROM: addresses are offsets into the array, as on the target
+static uint8_t *ee(const void *p) {
+    return &eeprom[(uintptr_t)p & E2END];
+}
+
+uint8_t eeprom_read_byte(const uint8_t *p) { return *ee(p); }
+void eeprom_write_byte(uint8_t *p, uint8_t v) { *ee(p) = v; }
+void eeprom_update_byte(uint8_t *p, uint8_t v) { *ee(p) = v; }
+
+void eeprom_read_block(void *dst, const void *src, size_t n) {
+    for (size_t i = 0; i < n; i++) ((uint8_t *)dst)[i] = *ee((const uint8_t *)src + i);
+}
+
+void eeprom_update_block(const void *src, void *dst, size_t n) {
+    for (size_t i = 0; i < n; i++) *ee((uint8_t *)dst + i) = ((const uint8_t *)src)[i];
+}
+
+void hal_eeprom_erase(void) {
+    memset(eeprom, 0xFF, sizeof(eeprom));
+}
@@ -0,0 +1,40 @@
+#ifndef HAL_H
+#define HAL_H
+
+#include <stdint.h>
+
+// Host-side device models behind the register shim.
+// Time is simulated: millis() (timebase.h) returns hal_ms, which only moves
+// through hal_advance_ms(). Every millis() call also runs the peripheral
+// models, so driver wait loops make progress exactly as on the target.
+
+// Driver ISRs (ISR(x) expands to hal_isr_x on the host)
+void hal_isr_USART_RX_vect(void);
+void hal_isr_USART_UDRE_vect(void);
+void hal_isr_TWI_vect(void);
+void hal_isr_TIMER0_COMPB_vect(void);   // buzzer pattern step (not modelled)
+
+void hal_reset(void);
+void hal_advance_ms(uint32_t ms);
+
+// Run the UART and TWI models until they have nothing left to do
+void hal_run(void);
+
+// UART: bytes the firmware transmits go to the hook (if set)
+typedef void (*hal_uart_tx_hook_t)(uint8_t c);
+void hal_uart_set_tx_hook(hal_uart_tx_hook_t hook);
+void hal_uart_rx(const char *s);   // deliver bytes to the RX interrupt
+void hal_uart_rx_n(const void *p, uint16_t n);     // binary ones
+
+// TWI: every addressed slave ACKs; counters for what went over the bus
+typedef struct {
+    uint32_t transactions;
+    uint32_t bytes;         // data bytes, excluding SLA+W
+} hal_twi_stats_t;
+
+void hal_twi_get_stats(hal_twi_stats_t *out);
+
+// EEPROM: all 0xFF, as shipped (hal_reset does this too)
+void hal_eeprom_erase(void);
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef HAL_UTIL_DELAY_H
+#define HAL_UTIL_DELAY_H
+
+// Busy delays cost nothing on the host; simulated time moves via hal_advance_ms()
+#define _delay_us(us) ((void)(us))
+#define _delay_ms(ms) ((void)(ms))
+
+#endif
@@ -1,192 +1,279 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 #include <stdint.h>
-#include <stdio.h>
 
 #include "gpio.h"
 #include "uart.h"
+#include "timebase.h"
+#include "twi.h"
 #include "sensor.h"
+#include "vote.h"
 #include "esp.h"
 #include "buzzer.h"
 #include "lcd_i2c.h"
+#include "lcd_fb.h"
+#include "level.h"
+#include "store.h"
+#include "agg.h"
+#include "clock.h"
+#include "sched.h"
+#include "ping.h"
+#include "prof.h"
+#include "fmt.h"
+#ifdef SRAM_REPORT
+#include "sram.h"
+#endif
 
 //CONFIGURATION 
 #define WIFI_SSID  "IJBC"
 #define WIFI_PASS  "ian12345"
 #define THINGSPEAK_API_KEY  "VYAV7M3MXXHXHFVE"
+#define THINGSPEAK_CHANNEL_ID  "0000000" // channel of the write key (bulk upload)
+// MQTT device of the channel, used with make EXTRA_CFLAGS=-DESP_MQTT=1
+#define MQTT_CLIENT_ID  ""
+#define MQTT_USERNAME   ""
+#define MQTT_PASSWORD   ""
 
-//STATE DEFINITIONS
-#define STATE_SAFE      0
-#define STATE_PREPARE   1
-#define STATE_EVAC      2
-
-//FILTERING VARIABLES
-#define FILTER_N 9
-static int16_t samples[FILTER_N];
-static uint8_t s_idx = 0;
-static uint8_t s_count = 0;
-
-//CONFIDENCE / DEBOUNCE VARIABLES 
-// 30 samples at 50ms = 1.5 seconds of consistent reading required to switch
-#define CONFIDENCE_THRESHOLD 30 
-static uint8_t pending_state = STATE_SAFE;
-static uint8_t stability_counter = 0;
-static uint8_t current_active_state = STATE_SAFE; 
-
-//MEDIAN FILTER 
-static void sort_array(int16_t *arr, uint8_t n) {
-    for (uint8_t i = 0; i < n - 1; i++) {
-        for (uint8_t j = 0; j < n - i - 1; j++) {
-            if (arr[j] > arr[j + 1]) {
-                int16_t temp = arr[j];
-                arr[j] = arr[j + 1];
-                arr[j + 1] = temp;
-            }
+// Every interval's statistics are queued (store.h) and uploaded when WiFi
+// allows: field1..8 as laid out in agg.h. The interval follows the state:
+// long while SAFE, which leaves the upload rate limit free for alerts, as
+// short as the limit allows in EVACUATE. A confirmed state change closes
+// the interval at once and queues it as an alert, ahead of the backlog.
+// Through an outage the interval grows with the backlog (store_log_interval)
+// so the store spans hours.
+#define LOG_SAFE_MS     60000UL
+#define LOG_PREPARE_MS  20000UL
+#define LOG_EVAC_MS     ((ESP_MIN_INTERVAL_MS > 5000UL) ? ESP_MIN_INTERVAL_MS : 5000UL)
+
+//DECISION PIPELINE (filter + classification + confidence, see level.h)
+// Median window is MEDIAN_N (median.h), e.g. make EXTRA_CFLAGS=-DMEDIAN_N=31
+static level_t lvl;
+static agg_t agg;
+static ping_t ping;
+static vote_t vote;    // fuses the SENSOR_N sensors (sensor.h)
+
+// Time to first alert, in ms after timebase_init() (a bootloader's wait
+// comes on top): LEDs and buzzer follow a confirmed state, and the LCD
+// shows it. 0 = not yet. Printed by sram-report / prof-report.
+static uint32_t boot_alert_ms = 0;
+static uint32_t boot_lcd_ms = 0;
+
+//TASKS (run by sched.c; the CPU idles in between)
+#define ESP_PERIOD_MS     10    // plus every received byte
+#define IO_PERIOD_MS      4     // ~ one EEPROM byte write time
+#define LCD_PERIOD_MS     100
+#define LCD_VALUE_MS      300
+#define LOG_PERIOD_MS     1000
+
+static void log_close(uint32_t now, uint8_t alert);
+
+//Process Data: posted by the sensor ISR per echo (Timer1 pings on its own);
+//drains every result queued since the last run, one level sample per round
+static void task_sample(void) {
+    sensor_echo_t e;
+    int16_t raw_cm = -1;
+    uint32_t now = millis();
+
+    while (sensor_read(&e)) {
+        if (!vote_add(&vote, e.id, sensor_cm(&e), &raw_cm)) continue;
+        {
+            PROF_BEGIN();
+            level_update(&lvl, raw_cm);
+            PROF_END(PROF_SAMPLE);
         }
+        agg_add(&agg, raw_cm, lvl.active_state, now);
     }
-}
+    sensor_set_period(ping_next(&ping, raw_cm, lvl.stable_cm, lvl.active_state, now));
+
+    //Update LEDs based on CONFIRMED State (Not raw distance); all off until
+    //the first one, WiFi or not
+    if (!lvl.live) {
+        leds_all_off();
+    } else {
+        switch(lvl.active_state) {
+            case STATE_EVAC:    leds_set_evacuate(); break;
+            case STATE_PREPARE: leds_set_prepare();  break;
+            case STATE_SAFE:    leds_set_safe();     break;
+        }
+        if (!boot_alert_ms) boot_alert_ms = now;
+    }
+    buzzer_task(lvl.active_state);  // the buzzer's ISR plays the pattern
 
-static int16_t get_median_cm(int16_t new_val) {
-    if (new_val <= 0 || new_val > 400) {
-        if (s_count == 0) return -1;
-        int16_t temp[FILTER_N];
-        for(uint8_t k=0; k<s_count; k++) temp[k] = samples[k];
-        sort_array(temp, s_count);
-        return temp[s_count/2];
+    // The cloud hears of a change now, not at the end of the interval
+    static uint8_t reported = STATE_SAFE;
+    if (lvl.live && lvl.active_state != reported) {
+        reported = lvl.active_state;
+        log_close(now, 1);
     }
-    samples[s_idx] = new_val;
-    s_idx = (s_idx + 1) % FILTER_N;
-    if (s_count < FILTER_N) s_count++;
-
-    int16_t temp[FILTER_N];
-    for (uint8_t i = 0; i < s_count; i++) temp[i] = samples[i];
-    sort_array(temp, s_count);
-    return temp[s_count / 2];
 }
 
-//CLASSIFICATION 
-static uint8_t classify_instant(int16_t cm) {
-    if (cm < 0) return STATE_SAFE;
-    if (cm <= 29) return STATE_EVAC;   // 0-29 cm
-    if (cm <= 33) return STATE_PREPARE;// 30-33 cm
-    return STATE_SAFE;                 // 35+ cm
+// WiFi State Machine (UART Interrupt Driven)
+static void task_esp(void) {
+    PROF_BEGIN();
+    esp_task();
+    PROF_END(PROF_ESP);
 }
 
-static const char* status_label(uint8_t state) {
-    switch(state) {
-        case STATE_EVAC:    return "    EVACUATE    ";
-        case STATE_PREPARE: return "     PREPARE    ";
-        case STATE_SAFE:    return "      SAFE      ";
-        default:            return "      SAFE      ";
+static void task_io(void) {
+    PROF_BEGIN();
+    twi_task();     // I2C timeouts / bus recovery (TWI Interrupt Driven)
+    (void)lcd_task();   // steps the LCD power-on sequence
+    store_task();   // EEPROM spill, one byte per run
+    PROF_END(PROF_IO);
+}
+
+//Log interval (uploaded by esp_task, kept through WiFi outages)
+static uint32_t log_start = 0;
+
+static void log_close(uint32_t now, uint8_t alert) {
+    reading_t r;
+    r.ts = clock_stamp();
+    agg_close(&agg, now, &r);
+    log_start = now;
+    if (alert) {
+        r.status = lvl.active_state;
+        store_push_alert(&r);
+    } else {
+        store_push(&r);
     }
 }
 
-int main(void) {
-    gpio_init();
-    uart_init(9600);
-    timebase_init();
-    sensor_init();
-    buzzer_init();
-    lcd_init();
+static void task_log(void) {
+    uint32_t now = millis();
+    uint32_t interval = store_log_interval((lvl.active_state == STATE_EVAC) ? LOG_EVAC_MS :
+                                           (lvl.active_state == STATE_PREPARE) ? LOG_PREPARE_MS : LOG_SAFE_MS);
+    if (!agg_samples(&agg) || (now - log_start) < interval) return;
 
-    sei(); // ENABLE GLOBAL INTERRUPTS
+    PROF_BEGIN();
+    log_close(now, 0);
+    PROF_END(PROF_LOG);
+}
 
-    lcd_clear();
-    lcd_set_cursor(0, 0);
-    lcd_print_16("Connecting WiFi");
-    
-    esp_begin(WIFI_SSID, WIFI_PASS);
+// WiFi indicator in the last cell of row 0
+static char wifi_mark(void) {
+    if (esp_is_uploading()) return '^';
+    return esp_online() ? '*' : '-';
+}
 
-    uint32_t nextMeasure = 0;
-    uint32_t lastSend = 0;
-    uint32_t lastLcd = 0;
-    
-    uint8_t showedReady = 0;
-    uint32_t readyShownAt = 0;
+static void task_lcd(void) {
+    static uint8_t drawn = 0xFF;    // state on screen, 0xFE = measuring
+    static uint32_t lastLcd = 0;
+    uint32_t now = millis();
 
-    int16_t raw_cm = -1;
-    int16_t stable_cm = -1; 
+    if (!lcd_task()) return;
+    PROF_BEGIN();
 
-    while (1) {
-        uint32_t now = millis();
-        esp_task(); // WiFi State Machine (UART Interrupt Driven)
+    // A state change is drawn at once, the level every LCD_VALUE_MS
+    uint8_t state = lvl.live ? lvl.active_state : 0xFE;
+    if (state != drawn || (now - lastLcd) >= LCD_VALUE_MS) {
+        lastLcd = now;
+        drawn = state;
 
-        //Trigger Measurement (Timer1 Interrupt Driven)
-        if ((int32_t)(now - nextMeasure) >= 0) {
-            nextMeasure = now + 50; 
-            sensor_start(); 
-        }
+        char row[LCD_FB_COLS + 1];
+        fmt_t f;
+        fmt_init(&f, row, sizeof(row));
+        fmt_P(&f, PSTR("Level: "));
+        if (lvl.stable_cm < 0) fmt_P(&f, PSTR("---"));
+        else fmt_u_w(&f, (uint16_t)lvl.stable_cm, 3);
+        fmt_P(&f, PSTR(" cm"));
+        lcd_fb_set_row(0, row);
+        lcd_fb_set_cell(0, LCD_FB_COLS - 1, wifi_mark());
 
-        //Process Data 
-        if (sensor_done()) {
-            raw_cm = sensor_get_cm();
-            
-            //Mathematical Smoothing
-            stable_cm = get_median_cm(raw_cm);
-
-            //Check which state this value BELONGS to
-            uint8_t detected_state = classify_instant(stable_cm);
-
-            // Confidence Check 
-            if (detected_state == pending_state) {
-                if (stability_counter < CONFIDENCE_THRESHOLD) {
-                    stability_counter++;
-                } else {
-                    // Confirmed! Update the REAL state
-                    current_active_state = pending_state;
-                }
-            } else {
-                // Fluke or Change? Reset and wait for proof
-                pending_state = detected_state;
-                stability_counter = 0;
-            }
-            
-            //Update LEDs based on CONFIRMED State (Not raw distance)
-            switch(current_active_state) {
-                case STATE_EVAC:    leds_set_evacuate(); break;
-                case STATE_PREPARE: leds_set_prepare();  break;
-                case STATE_SAFE:    leds_set_safe();     break;
-            }
-        }
+        if (lvl.live) lcd_fb_set_row_P(1, level_label_P(lvl.active_state));
+        else lcd_fb_set_row_P(1, PSTR("   MEASURING"));
+    }
 
-        //Update Buzzer 
-        buzzer_task(current_active_state, now);
+    // Only changed cells go out; a no-op when nothing changed
+    lcd_fb_flush();
+    if (lvl.live && !boot_lcd_ms) boot_lcd_ms = now;
+    PROF_END(PROF_LCD);
+}
 
-        //Update Cloud
-        if (esp_ready() && stable_cm > 0 && (now - lastSend) > 20000UL) {
-            if (esp_request_send_field1(THINGSPEAK_API_KEY, stable_cm)) {
-                lastSend = now;
-            }
-        }
+// GET /status on the LAN (esp.h), e.g.
+// {"cm":41,"state":"SAFE","live":1,"uptime":3605,"queued":0,"time":1790000000}
+// cm is -1 and live 0 until the first confirmed reading; time is 0 until
+// SNTP set the clock.
+static void status_json(fmt_t *f) {
+    fmt_P(f, PSTR("{\"cm\":"));
+    fmt_i(f, lvl.stable_cm);
+    fmt_P(f, PSTR(",\"state\":\""));
+    fmt_P(f, level_name_P(lvl.active_state));
+    fmt_P(f, PSTR("\",\"live\":"));
+    fmt_u(f, lvl.live);
+    fmt_P(f, PSTR(",\"uptime\":"));
+    fmt_u(f, millis() / 1000);
+    fmt_P(f, PSTR(",\"queued\":"));
+    fmt_u(f, store_count());
+    fmt_P(f, PSTR(",\"time\":"));
+    fmt_u(f, clock_unix());
+    fmt_P(f, PSTR("}\n"));
+}
 
-        //Update LCD
-        if (esp_ready() && !showedReady) {
-            showedReady = 1;
-            readyShownAt = now;
-            lcd_clear();
-            lcd_print_16("System Ready");
-        }
-        if (showedReady && readyShownAt != 0 && (now - readyShownAt) >= 1000UL) {
-            readyShownAt = 0;
-            lcd_clear();
-        }
+#if defined(SRAM_REPORT) || defined(PROF_REPORT)
+// make sram-report / prof-report: the ESP shares the UART and ignores these
+// lines. Profile counts restart with every dump.
+static void task_report(void) {
+    char line[48];
+    fmt_t f;
 
-        if (showedReady && readyShownAt == 0 && (now - lastLcd) >= 300UL) {
-            lastLcd = now;
+    fmt_init(&f, line, sizeof(line));
+    fmt_P(&f, PSTR("boot: alert "));
+    fmt_u(&f, boot_alert_ms);
+    fmt_P(&f, PSTR(" ms, lcd "));
+    fmt_u(&f, boot_lcd_ms);
+    fmt_P(&f, PSTR(" ms\r\n"));
+    uart_puts(line);
+#ifdef SRAM_REPORT
+    fmt_init(&f, line, sizeof(line));
+    fmt_P(&f, PSTR("sram: free "));
+    fmt_u(&f, sram_free());
+    fmt_P(&f, PSTR(", stack unused "));
+    fmt_u(&f, sram_stack_unused());
+    fmt_P(&f, PSTR("\r\n"));
+    uart_puts(line);
+#endif
+#ifdef PROF_REPORT
+    prof_dump();
+#endif
+}
+#endif
 
-            char line1[17];
-            if (stable_cm < 0) snprintf(line1, sizeof(line1), "Level: --- cm");
-            else snprintf(line1, sizeof(line1), "Level: %d cm", (int)stable_cm);
+int main(void) {
+    gpio_init();
+    uart_init(ESP_BAUD_BOOT);
+    timebase_init();
+    sensor_init();
+    buzzer_init();
+    level_init(&lvl);
+    clock_init(store_init());
+    agg_init(&agg, millis());
+    ping_init(&ping);
+    vote_init(&vote);
 
-            lcd_set_cursor(0, 0);
-            lcd_print_16(line1);
+    sei(); // ENABLE GLOBAL INTERRUPTS (LCD init runs on the TWI interrupt)
 
-            lcd_set_cursor(0, 1);
-            if (esp_is_uploading()) {
-                lcd_print_16(">> UPLOADING >>");
-            } else {
-                lcd_print_16(status_label(current_active_state));
-            }
-        }
-    }
-}
\ No newline at end of file
+    // Nothing below blocks: the LCD and the ESP come up in their tasks while
+    // sensing and the alarms already run
+    lcd_init();
+#ifdef LCD_BENCH
+    lcd_bench();
+#endif
+    lcd_fb_init();
+
+    esp_set_thingspeak(THINGSPEAK_API_KEY, THINGSPEAK_CHANNEL_ID);
+    esp_set_mqtt(MQTT_CLIENT_ID, MQTT_USERNAME, MQTT_PASSWORD);
+    esp_set_status(status_json);
+    esp_begin(WIFI_SSID, WIFI_PASS);
+
+    sched_add(task_sample, 0, SCHED_EV_SENSOR);
+    sched_add(task_esp, ESP_PERIOD_MS, SCHED_EV_UART_RX);
+    sched_add(task_io, IO_PERIOD_MS, 0);
+    sched_add(task_log, LOG_PERIOD_MS, 0);
+    sched_add(task_lcd, LCD_PERIOD_MS, 0);
+#if defined(SRAM_REPORT) || defined(PROF_REPORT)
+    sched_add(task_report, 10000, 0);
+#endif
+
+    sched_run();
+}